@@ -11,10 +11,20 @@
  * reads and also provides a synchronization point for disk blocks used by
  * multiple processes.
  *
+ * The cache is write-back: once the log has committed a block, the block is
+ * only marked dirty (bdirty), and reaches its home location later, when the
+ * flusher thread finds it old enough, when the log needs its space back, or
+ * when the buffer is recycled.
+ *
  * The buffer cache provides the following interface:
  * - To get a buffer for a particular disk block, call bread.
  * - After changing buffer data, call bwrite to write it to disk.
  * - When done with the buffer, call brelse.
+ * - To keep several writes in flight, hand each buffer to bwriteasync
+ *   instead of calling bwrite and brelse, then wait with bwaitall.
+ * - Writes that have completed may still sit in the disk's write
+ *   cache; call bbarrier to make them durable.
+ * - To fetch a block that will be wanted soon, call breadahead.
  * - Do not use the buffer after calling brelse.
  * - Only one process at a time can use a buffer, so do not keep them longer
  *  than necessary.
@@ -32,6 +42,77 @@
 #include "fs.h"
 #include "buf.h"
 
+#define FLUSHPERIOD 10 // ticks between runs of the flusher thread
+#define FLUSHAGE    30 // ticks a buffer stays dirty before the flusher writes it
+
+// Read or write b on its device. With RAMDISK, the root
+// disk is in memory; every other device is a virtio disk.
+// poll asks the disk to spin for the completion rather
+// than sleep at once.
+static void disk_rw(struct buf *b, int write, int poll)
+{
+#ifdef RAMDISK
+  if (b->dev == ROOTDEV)
+  {
+    ramdiskrw(b, write);
+    return;
+  }
+#endif
+  virtio_disk_rw(b, write, poll);
+}
+
+// Tell the disk that blocks [blockno, blockno+n) of dev hold
+// nothing worth keeping. They read back as anything until
+// rewritten. Returns -1 if the disk can't be told.
+int bdiscard(uint dev, uint blockno, uint n)
+{
+#ifdef RAMDISK
+  if (dev == ROOTDEV)
+    return -1;
+#endif
+  return virtio_disk_discard(dev, blockno, n);
+}
+
+// Make every completed write to dev durable. Writes that
+// complete after bbarrier starts may or may not be covered.
+void bbarrier(uint dev)
+{
+#ifdef RAMDISK
+  if (dev == ROOTDEV)
+    return;
+#endif
+  virtio_disk_flush(dev);
+}
+
+// Have the disk zero blocks [blockno, blockno+n) of dev on its
+// own, without a transfer of zeros. The cache isn't updated.
+// Returns -1 if the disk can't do it.
+int bdiskzero(uint dev, uint blockno, uint n)
+{
+#ifdef RAMDISK
+  if (dev == ROOTDEV)
+    return -1;
+#endif
+  return virtio_disk_zero(dev, blockno, n);
+}
+
+// Start reading or writing b, and return without waiting.
+// When the transfer is done, b->iodone(b) is called; it
+// must be set.
+static void disk_submit(struct buf *b, int write)
+{
+#ifdef RAMDISK
+  if (b->dev == ROOTDEV)
+  {
+    ramdiskrw(b, write);
+    if (b->iodone)
+      b->iodone(b);
+    return;
+  }
+#endif
+  virtio_disk_submit(b, write);
+}
+
 struct
 {
   struct spinlock lock;
@@ -41,6 +122,8 @@ struct
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  int nwriteback; // asynchronous writes still in flight
 } bcache;
 
 void binit(void)
@@ -62,6 +145,8 @@ void binit(void)
   }
 }
 
+static int flush(uint dev, uint age, int unused);
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -70,36 +155,51 @@ bget(uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for (b = bcache.head.next; b != &bcache.head; b = b->next)
+  for (;;)
   {
-    if (b->dev == dev && b->blockno == blockno)
+    acquire(&bcache.lock);
+
+    // Is the block already cached?
+    for (b = bcache.head.next; b != &bcache.head; b = b->next)
     {
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if (b->dev == dev && b->blockno == blockno)
+      {
+        b->refcnt++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev)
-  {
-    if (b->refcnt == 0)
+    // Not cached.
+    // Recycle the least recently used (LRU) unused clean buffer.
+    for (b = bcache.head.prev; b != &bcache.head; b = b->prev)
     {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+      if (b->refcnt == 0 && !b->dirty)
+      {
+        b->dev = dev;
+        b->blockno = blockno;
+        b->valid = 0;
+        b->refcnt = 1;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+
+    // Writes in flight release their buffers when done.
+    if (bcache.nwriteback > 0)
+    {
+      sleep(&bcache.nwriteback, &bcache.lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      continue;
     }
+    release(&bcache.lock);
+
+    // Every unused buffer is dirty: write them back and retry.
+    if (flush(0, 0, 1) == 0)
+      panic("bget: no buffers");
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -111,18 +211,221 @@ bread(uint dev, uint blockno)
   b = bget(dev, blockno);
   if (!b->valid)
   {
-    virtio_disk_rw(b, 0);
+    disk_rw(b, 0, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, filled with
+// zeros rather than read from disk, for a block whose old
+// contents don't matter.
+struct buf *
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+static void bput(struct buf *b);
+static void writeback_done(struct buf *b);
+
+// Start writing b's contents to disk, and return without
+// waiting. This hands b over: the caller must not use it
+// again, and it is released once the write is done.
+void bwriteasync(struct buf *b)
+{
+  if (!holdingsleep(&b->lock))
+    panic("bwriteasync");
+  acquire(&bcache.lock);
+  bcache.nwriteback++;
+  release(&bcache.lock);
+  b->iodone = writeback_done; // releases b
+  disownsleep(&b->lock);
+  disk_submit(b, 1);
+}
+
+// Wait until every write started by bwriteasync, by
+// anyone, has finished.
+void bwaitall(void)
+{
+  acquire(&bcache.lock);
+  while (bcache.nwriteback > 0)
+    sleep(&bcache.nwriteback, &bcache.lock);
+  release(&bcache.lock);
+}
+
+// A read-ahead finished, in the disk interrupt.
+// Release b for whoever wants it.
+static void readahead_done(struct buf *b)
+{
+  b->iodone = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Start reading the indicated block into the cache, if it
+// isn't there already, and return without waiting, so that a
+// bread() of it soon after finds it.
+void breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for (b = bcache.head.next; b != &bcache.head; b = b->next)
+  {
+    if (b->dev == dev && b->blockno == blockno)
+    {
+      release(&bcache.lock);
+      return;
+    }
+  }
+  release(&bcache.lock);
+
+  b = bget(dev, blockno);
+  if (b->valid)
+  {
+    brelse(b);
+    return;
+  }
+  b->iodone = readahead_done;
+  disownsleep(&b->lock); // readahead_done releases it
+  disk_submit(b, 0);
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b)
 {
   if (!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  disk_rw(b, 1, 0);
+  if (!b->txn)
+    b->dirty = 0;
+}
+
+// Like bwrite(), for writes that a caller waits on and
+// wants back soon, such as the log's: polls for the disk's
+// completion for a while before sleeping.
+void bwritepoll(struct buf *b)
+{
+  if (!holdingsleep(&b->lock))
+    panic("bwritepoll");
+  disk_rw(b, 1, 1);
+  if (!b->txn)
+    b->dirty = 0;
+}
+
+// Mark b as holding committed data that still has to be
+// written to its home location. Must be locked.
+void bdirty(struct buf *b)
+{
+  if (!holdingsleep(&b->lock))
+    panic("bdirty");
+  if (!b->dirty)
+  {
+    b->dirty = 1;
+    b->dirtytick = ticks;
+  }
+}
+
+// Does block (d1, b1) come before block (d2, b2) on the disks?
+static int before(uint d1, uint b1, uint d2, uint b2)
+{
+  return d1 < d2 || (d1 == d2 && b1 < b2);
+}
+
+// A write started by bwriteasync finished, in the disk
+// interrupt. Release b, and tell bwaitall if it was the last.
+static void writeback_done(struct buf *b)
+{
+  b->iodone = 0;
+  if (!b->txn)
+    b->dirty = 0;
+  releasesleep(&b->lock);
+  bput(b);
+
+  acquire(&bcache.lock);
+  if (--bcache.nwriteback == 0)
+    wakeup(&bcache.nwriteback);
+  release(&bcache.lock);
+}
+
+// Write back the dirty buffers of device dev (of every device if
+// dev is 0) that have been dirty for at least age ticks, in order
+// of device and block number. Skips buffers that the open
+// transaction has modified, and, if unused is set, buffers that
+// are in use. The writes go to the disk without waiting for each
+// other, and each buffer is released as soon as its write is done;
+// returns, once all are done, the number of buffers written.
+static int flush(uint dev, uint age, int unused)
+{
+  struct buf *b, *next;
+  uint cdev = 0, cblock = 0; // last block written
+  int n = 0;
+
+  for (;;)
+  {
+    // find the first eligible block after the last one written.
+    acquire(&bcache.lock);
+    next = 0;
+    for (b = bcache.buf; b < bcache.buf + NBUF; b++)
+    {
+      if (!b->dirty || b->txn || (dev && b->dev != dev) || ticks - b->dirtytick < age)
+        continue;
+      if (unused && b->refcnt > 0)
+        continue;
+      if (n > 0 && !before(cdev, cblock, b->dev, b->blockno))
+        continue;
+      if (next == 0 || before(b->dev, b->blockno, next->dev, next->blockno))
+        next = b;
+    }
+    if (next == 0)
+    {
+      release(&bcache.lock);
+      bwaitall();
+      return n;
+    }
+    next->refcnt++;
+    release(&bcache.lock);
+
+    acquiresleep(&next->lock);
+    cdev = next->dev;
+    cblock = next->blockno;
+    n++;
+    if (next->dirty && !next->txn)
+      bwriteasync(next);
+    else
+      brelse(next);
+  }
+}
+
+// Write back all committed blocks of device dev.
+void bflush(uint dev)
+{
+  flush(dev, 0, 0);
+}
+
+// Body of the flusher kernel thread: every FLUSHPERIOD ticks,
+// write back the buffers that have been dirty for FLUSHAGE.
+void bflusher(void)
+{
+  uint t0;
+
+  for (;;)
+  {
+    acquire(&tickslock);
+    t0 = ticks;
+    while (ticks - t0 < FLUSHPERIOD)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    flush(0, FLUSHAGE, 0);
+  }
 }
 
 // Release a locked buffer.
@@ -133,7 +436,12 @@ void brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
+// Drop a reference to b, whose lock is already released.
+static void bput(struct buf *b)
+{
   acquire(&bcache.lock);
   b->refcnt--;
   if (b->refcnt == 0)
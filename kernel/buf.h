@@ -9,7 +9,12 @@
  * 
  * The buffer structure contains the following fields:
  * - `valid`  : Indicates whether the buffer contains valid data read from disk.
- * - `disk`   : Indicates whether the buffer is owned by the disk.
+ * - `disk`   : Nonzero while the buffer is owned by the disk.
+ * - `dirty`  : Holds committed data not yet written to its home block.
+ * - `txn`    : Modified by the open log transaction; must not be written back.
+ * - `dirtytick`: Value of ticks when the buffer became dirty.
+ * - `iodone` : If set, called from the disk interrupt when an
+ *              asynchronous transfer of the buffer finishes.
  * - `dev`    : The device number of the disk containing the buffer.
  * - `blockno`: The block number of the disk block stored in the buffer.
  * - `refcnt` : The reference count of the buffer.
@@ -24,6 +29,10 @@ struct buf
 {
   int valid;
   int disk;
+  int dirty;
+  int txn;
+  uint dirtytick;
+  void (*iodone)(struct buf *);
   uint dev;
   uint blockno;
   uint refcnt;
@@ -31,6 +31,7 @@
  * - control-u -- kill line
  * - control-d -- end of file
  * - control-p -- print process list
+ * - control-t -- print scheduler statistics
  *
  *****************************************************************/
 
@@ -199,6 +200,8 @@ int consoleread(int user_dst, uint64 dst, int n)
  *
  * Special characters:
  * - C('P'): Prints the process list by calling procdump().
+ * - C('T'): Prints scheduler statistics by calling schedstat().
+ * - C('V'): Prints disk completion statistics by calling virtio_disk_stat().
  * - C('U'): Kills the current line by deleting characters until a newline is found.
  * - C('H') or '\x7f': Acts as a backspace, deleting the last character in the buffer.
  *
@@ -216,6 +219,14 @@ void consoleintr(int c)
         procdump();
         break;
 
+    case C('T'): // Print scheduler statistics.
+        schedstat();
+        break;
+
+    case C('V'): // Print disk statistics.
+        virtio_disk_stat();
+        break;
+
     case C('U'): // Kill line.
         while ((cons.e != cons.w) && (cons.buf[(cons.e - 1) % INPUT_BUF_SIZE] != '\n'))
         {
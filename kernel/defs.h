@@ -14,6 +14,7 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rcugp;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -22,10 +23,21 @@ struct superblock;
 // bio.c
 void          binit(void);
 struct buf    *bread(uint, uint);
+struct buf    *bnew(uint, uint);
 void          brelse(struct buf *);
 void          bwrite(struct buf *);
+void          bwritepoll(struct buf *);
+void          bwriteasync(struct buf *);
+void          bwaitall(void);
+void          bbarrier(uint);
+void          breadahead(uint, uint);
+int           bdiscard(uint, uint, uint);
+int           bdiskzero(uint, uint, uint);
 void          bpin(struct buf *);
 void          bunpin(struct buf *);
+void          bdirty(struct buf *);
+void          bflush(uint);
+void          bflusher(void);
 
 // console.c
 void          consoleinit(void);
@@ -43,15 +55,20 @@ void          fileinit(void);
 int           fileread(struct file *, uint64, int n);
 int           filestat(struct file *, uint64 addr);
 int           filewrite(struct file *, uint64, int n);
+int           fileallocate(struct file *, uint, uint);
+int           filetruncate(struct file *, uint);
+int           fileseek(struct file *, int, int);
 
 // fs.c
-void          fsinit(int);
+int           fsinit(int);
 int           dirlink(struct inode *, char *, uint);
 struct inode  *dirlookup(struct inode *, char *, uint *);
-struct inode  *ialloc(uint, short);
+void          dcacheremove(struct inode *, char *);
+struct inode  *ialloc(uint, short, uint);
 struct inode  *idup(struct inode *);
 void          iinit();
 void          ilock(struct inode *);
+void          ilockshared(struct inode *);
 void          iput(struct inode *);
 void          iunlock(struct inode *);
 void          iunlockput(struct inode *);
@@ -62,12 +79,28 @@ struct inode  *nameiparent(char *, char *);
 int           readi(struct inode *, int, uint64, uint, uint);
 void          stati(struct inode *, struct stat *);
 int           writei(struct inode *, int, uint64, uint, uint);
-void          itrunc(struct inode *);
+int           itrunc(struct inode *, uint);
+int           fallocatei(struct inode *, uint, uint);
+void          mountinit(void);
+int           fsmount(struct inode *, struct inode *);
+int           fsmounted(struct inode *);
+int           fsunmount(struct inode *);
+struct inode  *fsattach(uint);
+void          fsdetach(uint);
+
+// rcu.c
+void          rcu_read_lock(void);
+void          rcu_read_unlock(void);
+void          rcu_gpstart(struct rcugp *);
+int           rcu_gpdone(struct rcugp *);
 
 // ramdisk.c
 void          ramdiskinit(void);
-void          ramdiskintr(void);
-void          ramdiskrw(struct buf *);
+void          ramdiskrw(struct buf *, int);
+
+// ipi.c
+void          ipi_send(int);
+void          ipi_intr(void);
 
 // kalloc.c
 void          *kalloc(void);
@@ -75,10 +108,16 @@ void          kfree(void *);
 void          kinit(void);
 
 // log.c
+void          loginit(void);
 void          initlog(int, struct superblock *);
+void          detachlog(int);
 void          log_write(struct buf *);
 void          begin_op(void);
 void          end_op(void);
+void          log_sync(int);
+void          log_discard(uint, uint);
+int           log_undiscard(uint, uint, uint);
+int           log_holds(uint, uint);
 
 // pipe.c
 int           pipealloc(struct file **, struct file **);
@@ -102,6 +141,8 @@ void          proc_freepagetable(pagetable_t, uint64);
 int           kill(int);
 int           killed(struct proc *);
 void          setkilled(struct proc *);
+int           setaffinity(int, uint64);
+int           getaffinity(int, uint64);
 struct cpu    *mycpu(void);
 struct cpu    *getmycpu(void);
 struct proc   *myproc();
@@ -112,10 +153,13 @@ void          sleep(void *, struct spinlock *);
 void          userinit(void);
 int           wait(uint64);
 void          wakeup(void *);
+void          wakeone(void *);
 void          yield(void);
 int           either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int           either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void          procdump(void);
+void          schedstat(void);
+void          kthread(char *, void (*)(void));
 
 // swtch.S
 void          swtch(struct context *, struct context *);
@@ -132,6 +176,10 @@ void          pop_off(void);
 void          acquiresleep(struct sleeplock *);
 void          releasesleep(struct sleeplock *);
 int           holdingsleep(struct sleeplock *);
+void          disownsleep(struct sleeplock *);
+void          acquiresleepshared(struct sleeplock *);
+void          releasesleepshared(struct sleeplock *);
+int           holdingsleepshared(struct sleeplock *);
 void          initsleeplock(struct sleeplock *, char *);
 
 // string.c
@@ -151,6 +199,15 @@ int           fetchstr(uint64, char *, int);
 int           fetchaddr(uint64, uint64 *);
 void          syscall();
 
+// tlb.c
+void          tlb_poll(void);
+void          tlb_shootdown(pagetable_t, uint64, uint64);
+
+// tmpfs.c
+void          tmpfsinit(void);
+struct inode  *tmpfsmake(void);
+void          tmpfsdrop(uint);
+
 // trap.c
 extern uint   ticks;
 void          trapinit(void);
@@ -192,8 +249,14 @@ void          plic_complete(int);
 
 // virtio_disk.c
 void          virtio_disk_init(void);
-void          virtio_disk_rw(struct buf *, int);
-void          virtio_disk_intr(void);
+int           virtio_disk_present(uint);
+void          virtio_disk_rw(struct buf *, int, int);
+void          virtio_disk_submit(struct buf *, int);
+int           virtio_disk_discard(uint, uint, uint);
+int           virtio_disk_zero(uint, uint, uint);
+void          virtio_disk_flush(uint);
+void          virtio_disk_intr(int);
+void          virtio_disk_stat(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
@@ -40,7 +40,7 @@ int exec(char *path, char **argv)
         return -1;
     }
 
-    ilock(ip);
+    ilockshared(ip);
 
     // Check ELF header
     if (readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -145,6 +145,9 @@ int exec(char *path, char **argv)
     // Commit to the user image.
     oldpagetable = p->pagetable;
     p->pagetable = pagetable;
+    push_off();
+    mycpu()->pagetable = pagetable;
+    pop_off();
     p->sz = sz;
     p->trapframe->epc = elf.entry; // initial program counter = main
     p->trapframe->sp = sp;         // initial stack pointer
@@ -11,6 +11,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
@@ -76,9 +77,12 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    int logged = ff.ip->ops->logged;
+    if(logged)
+      begin_op();
     iput(ff.ip);
-    end_op();
+    if(logged)
+      end_op();
   }
 }
 
@@ -91,7 +95,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -118,7 +122,12 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // f->off needs the inode locked exclusively if
+    // other processes share f, and so may read it too.
+    if(f->ref > 1)
+      ilock(f->ip);
+    else
+      ilockshared(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -152,19 +161,23 @@ filewrite(struct file *f, uint64 addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // file systems without a log take it all at once.
+    int logged = f->ip->ops->logged;
+    int max = logged ? ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE : n;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      if(logged)
+        begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      if(logged)
+        end_op();
 
       if(r != n1){
         // error from writei
@@ -180,3 +193,96 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Preallocate storage for bytes off..off+n-1 of file f,
+// without changing its contents or size.
+int
+fileallocate(struct file *f, uint off, uint n)
+{
+  int logged, r = 0;
+  uint bn, end, n1, max;
+
+  if(f->writable == 0 || f->type != FD_INODE || off + n < off)
+    return -1;
+
+  logged = f->ip->ops->logged;
+  end = off + n;
+  while(r == 0 && off < end){
+    if(logged)
+      begin_op();
+    ilock(f->ip);
+    n1 = end - off;
+    if(logged){
+      // a few blocks per transaction: each newly allocated
+      // block may dirty a different bitmap block, and inside
+      // the file it is zeroed through the log; besides, the
+      // i-node, the indirect block, and the bitmap block of
+      // the indirect block.
+      max = off < f->ip->size ? (MAXOPBLOCKS-3) / 2 : MAXOPBLOCKS-3;
+      bn = off / BSIZE;
+      if(n1 > (bn + max) * BSIZE - off)
+        n1 = (bn + max) * BSIZE - off;
+    }
+    if(f->ip->type == T_DIR)
+      r = -1;
+    else
+      r = fallocatei(f->ip, off, n1);
+    iunlock(f->ip);
+    if(logged)
+      end_op();
+    off += n1;
+  }
+  return r;
+}
+
+// Set the size of file f to n bytes. Growing it leaves
+// a hole, which reads as zeros.
+int
+filetruncate(struct file *f, uint n)
+{
+  int logged, r = 0;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+
+  logged = f->ip->ops->logged;
+  if(logged)
+    begin_op();
+  ilock(f->ip);
+  if(f->ip->type == T_DIR)
+    r = -1;
+  else
+    r = itrunc(f->ip, n);
+  iunlock(f->ip);
+  if(logged)
+    end_op();
+  return r;
+}
+
+// Move the offset of file f, to off bytes from the start
+// of the file, from the current offset, or from the end,
+// depending on whence. The new offset may lie past the end,
+// and a write there leaves a hole. Returns the new offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int r;
+
+  if(f->type != FD_INODE)
+    return -1;
+
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    r = off;
+  else if(whence == SEEK_CUR)
+    r = f->off + off;
+  else if(whence == SEEK_END)
+    r = f->ip->size + off;
+  else
+    r = -1;
+  if(r >= 0)
+    f->off = r;
+  else
+    r = -1;
+  iunlock(f->ip);
+  return r;
+}
@@ -18,6 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inodeops *ops; // File system of dev
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,9 +27,25 @@ struct inode {
   short minor;
   short nlink;
   uint size;
+  int inlined;        // contents are in addrs[]; see DI_INLINE
   uint addrs[NDIRECT+1];
 };
 
+// file system specific inode operations; see fs.c.
+struct inodeops {
+  uint (*ialloc)(uint, short, uint); // allocate an inode near another, return inum or 0
+  void (*iread)(struct inode*);   // fill in ip->type &c for ilock()
+  void (*iupdate)(struct inode*);
+  int (*itrunc)(struct inode*, uint);   // set the size
+  int (*fallocate)(struct inode*, uint, uint);
+  int (*readi)(struct inode*, int, uint64, uint, uint);
+  int (*writei)(struct inode*, int, uint64, uint, uint);
+  int logged;                     // changes go through log.c
+};
+
+extern struct inodeops diskops;
+extern struct inodeops tmpops;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
@@ -20,11 +20,16 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "rcu.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+// what a hole in a file reads as.
+static char zeros[BSIZE];
+// one superblock per disk device, indexed by device number.
+struct superblock sb[NDISK+1];
+
+static void imapinit(uint dev);
+static void dcacheinit(void);
 
 // Read the super block.
 static void
@@ -37,51 +42,80 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Init fs
-void
+// Init fs on disk dev.
+// Returns -1 if dev holds no file system.
+int
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
-  initlog(dev, &sb);
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC)
+    return -1;
+  initlog(dev, &sb[dev]);
+  imapinit(dev);
+  return 0;
 }
 
-// Zero a block.
+// Zero a block just allocated. reused says whether the open
+// transaction freed it before (see ballocrun()). If not, the
+// last commit has it free, and if the log holds no copy of it
+// for recovery to write back either, the disk can zero it in
+// place, which saves log space and the transfer of a block of
+// zeros. Otherwise a crash before the commit would give its
+// old owner back a block of zeros: zero it through the log.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int reused)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  bp = bnew(dev, bno);
+  if(reused || bp->txn || bp->dirty || log_holds(dev, bno) || bdiskzero(dev, bno, 1) < 0)
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint balloc(uint dev)
+// Is bit bi of free map block bp clear?
+static int bisfree(struct buf *bp, uint bi)
+{
+  return (bp->data[bi / 8] & (1 << (bi % 8))) == 0;
+}
+
+// Allocate a run of up to *n contiguous disk blocks, starting
+// at the first free block at or after goal, and going on to
+// the following groups (wrapping around) if goal's group is
+// full. A run stays within one group, so it takes a single
+// update of one bitmap block. Sets *n to the length of the
+// run, and *reused to whether the open transaction freed any
+// of its blocks before. The blocks are not zeroed. Returns the
+// first block, or 0 if out of disk space.
+static uint ballocrun(uint dev, uint goal, uint *n, int *reused)
 {
-  int b, bi, m;
+  struct superblock *s = &sb[dev];
+  uint b, bi, len, k, g0, nbits;
   struct buf *bp;
 
-  bp = 0;
-  for (b = 0; b < sb.size; b += BPB)
+  if (goal < s->groupstart || goal >= s->size)
+    goal = s->groupstart;
+  g0 = BGROUP(goal, *s);
+
+  // visit goal's group again at the end, for the
+  // blocks before goal.
+  for (k = 0; k <= s->ngroups; k++)
   {
-    bp = bread(dev, BBLOCK(b, sb));
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++)
+    b = GSTART((g0 + k) % s->ngroups, *s);
+    nbits = min(s->groupsize, s->size - b);
+    bp = bread(dev, b);
+    for (bi = (k == 0 ? goal - b : 0); bi < nbits; bi++)
     {
-      m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0)
-      {                        // Is block free?
-        bp->data[bi / 8] |= m; // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if (!bisfree(bp, bi))
+        continue;
+      for (len = 0; len < *n && bi + len < nbits && bisfree(bp, bi + len); len++)
+        bp->data[(bi + len) / 8] |= 1 << ((bi + len) % 8); // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      *reused = log_undiscard(dev, b + bi, len);
+      *n = len;
+      return b + bi;
     }
     brelse(bp);
   }
@@ -89,14 +123,33 @@ static uint balloc(uint dev)
   return 0;
 }
 
+// Where to look for free blocks for inode ip:
+// at the start of its group.
+static uint bgoal(struct inode *ip)
+{
+  return GSTART(IGROUP(ip->inum, sb[ip->dev]), sb[ip->dev]);
+}
+
+// Allocate a zeroed disk block for inode ip.
+// returns 0 if out of disk space.
+static uint balloc(struct inode *ip)
+{
+  uint b, n = 1;
+  int reused;
+
+  if ((b = ballocrun(ip->dev, bgoal(ip), &n, &reused)) != 0)
+    bzero(ip->dev, b, reused);
+  return b;
+}
+
 // Free a disk block.
 static void bfree(int dev, uint b)
 {
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
+  bp = bread(dev, BBLOCK(b, sb[dev]));
+  bi = BBIT(b, sb[dev]);
   m  = 1 << (bi % 8);
 
   if ((bp->data[bi / 8] & m) == 0)
@@ -108,6 +161,7 @@ static void bfree(int dev, uint b)
   
   log_write(bp);
   brelse(bp);
+  log_discard(dev, b);
 }
 
 // Inodes.
@@ -117,9 +171,9 @@ static void bfree(int dev, uint b)
 // its size, the number of links referring to it, and the
 // list of blocks holding the file's content.
 //
-// The inodes are laid out sequentially on disk at block
-// sb.inodestart. Each inode has a number, indicating its
-// position on the disk.
+// The inodes are laid out sequentially in the inode blocks of
+// each block group, ipg per group. Each inode has a number,
+// indicating its position on the disk.
 //
 // The kernel keeps a table of in-use inodes in memory
 // to provide a place for synchronizing access
@@ -150,7 +204,10 @@ static void bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. Code that only examines
+//   them (readi(), stati(), dirlookup()) may lock the inode
+//   shared with ilockshared(), so that any number of
+//   processes can read it at once.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -170,6 +227,12 @@ static void bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// Not every inode lives on the disk: ip->ops holds the file
+// system specific halves of ialloc(), ilock(), iupdate(),
+// itrunc(), fallocatei(), readi() and writei(). iget() picks them by device
+// number: diskops below for the disk, tmpops (tmpfs.c) for
+// in-memory file systems.
+//
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
@@ -184,6 +247,19 @@ struct {
   struct inode inode[NINODE];
 } itable;
 
+// Each disk's free inodes, as a bitmap in memory, so that
+// ialloc() needn't read through the inode blocks to find one.
+// Built by imapinit() when the disk is attached. A disk with
+// more than NIMAP inodes uses only the first NIMAP.
+#define NIMAP (8*BSIZE)
+
+struct imap {
+  struct spinlock lock;
+  uint ninodes;               // inodes covered by the map
+  uchar used[NIMAP/8];        // bit set: inode in use
+  uint next[NIMAP/IPB];       // per group: none free below this
+} imap[NDISK+1];
+
 void
 iinit()
 {
@@ -193,35 +269,147 @@ iinit()
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
+  for(i = 0; i <= NDISK; i++)
+    initlock(&imap[i].lock, "imap");
+  dcacheinit();
+}
+
+// Build dev's map of free inodes from its inode blocks.
+// Called when the file system is attached, after recovery.
+static void
+imapinit(uint dev)
+{
+  struct imap *m = &imap[dev];
+  struct superblock *s = &sb[dev];
+  uint inum, g, n, i;
+  struct buf *bp;
+  struct dinode *dip;
+
+  n = min(s->ninodes, NIMAP);
+  if(n < s->ninodes)
+    printf("fs: dev %d: using %d of %d inodes\n", dev, n, s->ninodes);
+
+  acquire(&m->lock);
+  memset(m->used, 0, sizeof(m->used));
+  release(&m->lock);
+  for(inum = 0; inum < n; inum += IPB){
+    bp = bread(dev, IBLOCK(inum, *s));
+    acquire(&m->lock);
+    for(i = inum; i < inum + IPB; i++){
+      dip = (struct dinode*)bp->data + i%IPB;
+      if(dip->type != 0)
+        m->used[i / 8] |= 1 << (i % 8);
+    }
+    release(&m->lock);
+    brelse(bp);
+  }
+
+  acquire(&m->lock);
+  m->used[0] |= 1;  // inode 0 is never used.
+  m->ninodes = n;
+  for(g = 0; g < s->ngroups && g * s->ipg < n; g++)
+    m->next[g] = g * s->ipg;
+  release(&m->lock);
+}
+
+// Take a free inode from dev's map, from the group of near if
+// it has one, else from the following groups. Each group's
+// next-free hint skips the inodes known to be in use, so this
+// doesn't look at a used inode twice. Returns 0 if none is free.
+static uint
+imapget(uint dev, uint near)
+{
+  struct imap *m = &imap[dev];
+  struct superblock *s = &sb[dev];
+  uint inum, g, k, end;
+
+  acquire(&m->lock);
+  for(k = 0; k < s->ngroups; k++){
+    g = (IGROUP(near, *s) + k) % s->ngroups;
+    if(g * s->ipg >= m->ninodes)
+      continue;
+    end = min((g + 1) * s->ipg, m->ninodes);
+    for(inum = m->next[g]; inum < end; inum++){
+      if((m->used[inum / 8] & (1 << (inum % 8))) == 0){
+        m->used[inum / 8] |= 1 << (inum % 8);
+        m->next[g] = inum + 1;
+        release(&m->lock);
+        return inum;
+      }
+    }
+    m->next[g] = end;
+  }
+  release(&m->lock);
+  return 0;
+}
+
+// Return inode inum to dev's map of free inodes.
+static void
+imapput(uint dev, uint inum)
+{
+  struct imap *m = &imap[dev];
+  uint g = IGROUP(inum, sb[dev]);
+
+  if(inum >= m->ninodes)
+    return;
+  acquire(&m->lock);
+  m->used[inum / 8] &= ~(1 << (inum % 8));
+  if(inum < m->next[g])
+    m->next[g] = inum;
+  release(&m->lock);
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// Which file system implements device dev?
+static struct inodeops*
+devops(uint dev)
+{
+  if(dev >= TMPDEV)
+    return &tmpops;
+  return &diskops;
+}
+
+// Allocate an inode on device dev, near inode near (the
+// directory it goes in), or anywhere if near is 0.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
+{
+  uint inum;
+
+  if((inum = devops(dev)->ialloc(dev, type, near)) == 0)
+    return 0;
+  return iget(dev, inum);
+}
+
+// Allocate an on-disk inode; return its number, or 0.
+// The free-inode map picks it, preferring near's group,
+// so this reads just the one inode block.
+static uint
+diskialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
+  if((inum = imapget(dev, near)) == 0){
+    printf("ialloc: no inodes\n");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+  bp = bread(dev, IBLOCK(inum, sb[dev]));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode map");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  if(type != T_DEVICE)
+    dip->type |= DI_INLINE;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return inum;
 }
 
 // Copy a modified in-memory inode to disk.
@@ -230,13 +418,21 @@ ialloc(uint dev, short type)
 // Caller must hold ip->lock.
 void
 iupdate(struct inode *ip)
+{
+  ip->ops->iupdate(ip);
+}
+
+static void
+diskiupdate(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
+  if(ip->type && ip->inlined)
+    dip->type |= DI_INLINE;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
@@ -244,6 +440,8 @@ iupdate(struct inode *ip)
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  if(ip->type == 0)   // iput() freed it
+    imapput(ip->dev, ip->inum);
 }
 
 // Find the inode with number inum on device dev
@@ -277,6 +475,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ops = devops(dev);
   release(&itable.lock);
 
   return ip;
@@ -298,38 +497,72 @@ idup(struct inode *ip)
 void
 ilock(struct inode *ip)
 {
-  struct buf *bp;
-  struct dinode *dip;
-
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    ip->ops->iread(ip);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
-// Unlock the given inode.
+// Copy an on-disk inode into ip.
+static void
+diskiread(struct inode *ip)
+{
+  struct buf *bp;
+  struct dinode *dip;
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
+  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  ip->type = dip->type & ~DI_INLINE;
+  ip->inlined = (dip->type & DI_INLINE) != 0;
+  ip->major = dip->major;
+  ip->minor = dip->minor;
+  ip->nlink = dip->nlink;
+  ip->size = dip->size;
+  memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+  brelse(bp);
+}
+
+// Lock the given inode shared, for reading only.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+
+  // readers can't fill in the inode: let ilock()
+  // do it, and try again.
+  while(ip->valid == 0){
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleepshared(&ip->lock);
+  }
+}
+
+// Unlock the given inode, locked with either
+// ilock() or ilockshared().
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  if(holdingsleep(&ip->lock))
+    releasesleep(&ip->lock);
+  else if(holdingsleepshared(&ip->lock))
+    releasesleepshared(&ip->lock);
+  else
+    panic("iunlock");
 }
 
 // Drop a reference to an in-memory inode.
@@ -337,8 +570,8 @@ iunlock(struct inode *ip)
 // be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
-// All calls to iput() must be inside a transaction in
-// case it has to free the inode.
+// All calls to iput() on a logged file system must be
+// inside a transaction in case it has to free the inode.
 void
 iput(struct inode *ip)
 {
@@ -353,7 +586,7 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
+    itrunc(ip, 0);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -381,6 +614,11 @@ iunlockput(struct inode *ip)
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
+//
+// Contents of up to NINLINE bytes instead sit in addrs[]
+// itself (ip->inlined), and come in with the inode, with
+// no block to read. bspill() moves them to a block once
+// the file grows bigger.
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -393,7 +631,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -405,7 +643,7 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
@@ -413,7 +651,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -426,40 +664,254 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Return the disk block address of the nth block in inode ip,
+// or 0 if there is none. Unlike bmap(), never allocates.
+static uint
+bmapped(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+  uint addr;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  if(ip->addrs[NDIRECT] == 0)
+    return 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  addr = ((uint*)bp->data)[bn - NDIRECT];
+  brelse(bp);
+  return addr;
+}
+
+// Make disk block addr the nth block in inode ip.
+// Returns -1 if there is no space for the indirect block.
+static int
+bset(struct inode *ip, uint bn, uint addr)
+{
+  struct buf *bp;
+
+  if(bn < NDIRECT){
+    ip->addrs[bn] = addr;
+    return 0;
+  }
+  if(ip->addrs[NDIRECT] == 0 && (ip->addrs[NDIRECT] = balloc(ip)) == 0)
+    return -1;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  ((uint*)bp->data)[bn - NDIRECT] = addr;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Give inode ip disk blocks for all of its blocks bn..bn+nb-1
+// that have none, all at once rather than one by one as a write
+// reaches them: as one run (or as few runs as free space allows),
+// placed right after the block before them. This keeps a growing
+// file contiguous, and updates the bitmap once per run. Returns
+// -1 if the disk is full. If reused isn't 0, sets *reused to
+// whether the open transaction freed any of the blocks before.
+static int
+bfill(struct inode *ip, uint bn, uint nb, int *reused)
 {
-  int i, j;
+  uint i, need, goal, addr, len;
+  int r;
+
+  if(reused)
+    *reused = 0;
+  need = 0;
+  for(i = bn; i < bn + nb; i++)
+    if(bmapped(ip, i) == 0)
+      need++;
+  if(need == 0)
+    return 0;
+  while(bmapped(ip, bn))
+    bn++;
+  if(bn == 0 || (goal = bmapped(ip, bn - 1)) == 0)
+    goal = bgoal(ip);
+  else
+    goal++;
+
+  while(need > 0){
+    len = need;
+    if((addr = ballocrun(ip->dev, goal, &len, &r)) == 0)
+      return -1;
+    if(reused)
+      *reused |= r;
+    need -= len;
+    goal = addr + len;
+    for(; len > 0; bn++){
+      if(bmapped(ip, bn))
+        continue;
+      if(bset(ip, bn, addr) < 0){
+        while(len-- > 0)
+          bfree(ip->dev, addr++);
+        return -1;
+      }
+      addr++;
+      len--;
+    }
+  }
+  return 0;
+}
+
+// Move the inline contents of ip to a data block, so that
+// it can grow past NINLINE bytes. Returns -1 if the disk
+// is full.
+static int
+bspill(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->inlined = 0;
+  if(ip->size == 0)
+    return 0;
+  if(bfill(ip, 0, 1, 0) < 0){
+    memmove(ip->addrs, data, NINLINE);
+    ip->inlined = 1;
+    return -1;
+  }
+  bp = bnew(ip->dev, ip->addrs[0]);
+  memmove(bp->data, data, NINLINE);
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Free blocks first..end-1 of inode ip, leaving holes.
+static void
+bunmap(struct inode *ip, uint first, uint end)
+{
+  uint i, *a;
   struct buf *bp;
-  uint *a;
+  int dirty = 0;
 
-  for(i = 0; i < NDIRECT; i++){
+  for(i = first; i < end && i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
 
-  if(ip->addrs[NDIRECT]){
+  if(end > NDIRECT && ip->addrs[NDIRECT]){
     bp = bread(ip->dev, ip->addrs[NDIRECT]);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(i = (first > NDIRECT ? first : NDIRECT); i < end && i < MAXFILE; i++){
+      if(a[i - NDIRECT]){
+        bfree(ip->dev, a[i - NDIRECT]);
+        a[i - NDIRECT] = 0;
+        dirty = 1;
+      }
     }
+    if(dirty)
+      log_write(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+  }
+}
+
+// Set the size of inode ip. Shrinking discards the contents
+// past the new end, along with any blocks preallocated there;
+// growing leaves a hole that reads as zeros. Returns -1 if
+// out of space; never fails for size 0.
+// Caller must hold ip->lock.
+int
+itrunc(struct inode *ip, uint size)
+{
+  return ip->ops->itrunc(ip, size);
+}
+
+static int
+diskitrunc(struct inode *ip, uint size)
+{
+  uint addr, keep;
+  struct buf *bp;
+
+  if(ip->inlined && size <= NINLINE){
+    if(size < ip->size)
+      memset((char*)ip->addrs + size, 0, NINLINE - size);
+    ip->size = size;
+    iupdate(ip);
+    return 0;
+  }
+  if(ip->inlined && bspill(ip) < 0)
+    return -1;
+
+  keep = (size + BSIZE - 1) / BSIZE;  // blocks still in use
+
+  if(size < ip->size){
+    // zero the tail of the last block, in case the
+    // file grows again.
+    if(size % BSIZE && (addr = bmapped(ip, size / BSIZE)) != 0){
+      bp = bread(ip->dev, addr);
+      memset(bp->data + size % BSIZE, 0, BSIZE - size % BSIZE);
+      log_write(bp);
+      brelse(bp);
+    }
+    bunmap(ip, keep, MAXFILE);
+    if(keep <= NDIRECT && ip->addrs[NDIRECT]){
+      bfree(ip->dev, ip->addrs[NDIRECT]);
+      ip->addrs[NDIRECT] = 0;
+    }
+  } else {
+    // blocks preallocated past the old end would show up
+    // inside the file with stale contents; make them holes.
+    bunmap(ip, (ip->size + BSIZE - 1) / BSIZE, keep);
   }
 
-  ip->size = 0;
+  // an empty file has no blocks left: start over inline.
+  if(size == 0)
+    ip->inlined = 1;
+  ip->size = size;
   iupdate(ip);
+  return 0;
 }
 
-// Copy stat information from inode.
+// Give inode ip storage for bytes off..off+n-1, without
+// writing them or changing its size, so that a later write
+// there doesn't have to allocate. Returns -1 if that
+// is beyond the largest file or there is no space.
 // Caller must hold ip->lock.
+int
+fallocatei(struct inode *ip, uint off, uint n)
+{
+  if(off + n < off)
+    return -1;
+  if(n == 0)
+    return 0;
+  return ip->ops->fallocate(ip, off, n);
+}
+
+static int
+diskfallocate(struct inode *ip, uint off, uint n)
+{
+  uint bn, first, last;
+  int r = 0, reused;
+
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+  if(ip->inlined){
+    if(off + n <= NINLINE)
+      return 0;
+    if(bspill(ip) < 0)
+      return -1;
+  }
+  first = off/BSIZE;
+  last = (off + n - 1)/BSIZE;
+
+  // holes inside the file must go on reading as zeros.
+  for(bn = first; r == 0 && bn <= last && bn*BSIZE < ip->size; bn++){
+    if(bmapped(ip, bn) == 0 && (r = bfill(ip, bn, 1, &reused)) == 0)
+      bzero(ip->dev, bmapped(ip, bn), reused);
+  }
+  if(r == 0)
+    r = bfill(ip, first, last - first + 1, 0);
+  iupdate(ip);
+  return r;
+}
+
+// Copy stat information from inode.
+// Caller must hold ip->lock, perhaps shared.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -471,13 +923,19 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  return ip->ops->readi(ip, user_dst, dst, off, n);
+}
+
+static int
+diskreadi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m, addr;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -485,12 +943,22 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->inlined){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    addr = bmapped(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(addr == 0){
+      // a hole: zeros, without touching the disk.
+      if(either_copyout(user_dst, dst, zeros, m) == -1)
+        return -1;
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -498,6 +966,12 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+
+  // a reader that got to the end of a block will likely
+  // want the next one: start reading it now.
+  if(tot == n && n > 0 && off % BSIZE == 0 && off < ip->size &&
+     (addr = bmapped(ip, off/BSIZE)) != 0)
+    breadahead(ip->dev, addr);
   return tot;
 }
 
@@ -511,19 +985,65 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  return ip->ops->writei(ip, user_src, src, off, n);
+}
+
+static int
+diskwritei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m, size, bn, first, last;
+  int newfirst, newlast;
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  if(off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->inlined){
+    if(off + n <= NINLINE){
+      char data[NINLINE];
+      if(either_copyin(data, user_src, src, n) == -1)
+        return -1;
+      memmove((char*)ip->addrs + off, data, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(bspill(ip) < 0)
+      return -1;
+  }
+
+  // writing past the end leaves a hole up to off. blocks
+  // preallocated there would show up with stale contents.
+  if(off > ip->size)
+    bunmap(ip, (ip->size + BSIZE - 1) / BSIZE, off/BSIZE);
+
+  // allocate the blocks this write adds to the file up front;
+  // any that can't be allocated make bmap() fail below. the
+  // ones that fill a hole hold whatever a freed block held,
+  // which the write doesn't cover if it starts or ends inside
+  // them; blocks in between are overwritten whole.
+  first = off/BSIZE;
+  last = n > 0 ? (off + n - 1)/BSIZE : first;
+  newfirst = bmapped(ip, first) == 0;
+  newlast = bmapped(ip, last) == 0;
+  if(n > 0)
+    bfill(ip, first, last - first + 1, 0);
+  size = ip->size;
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    bn = off/BSIZE;
+    uint addr = bmap(ip, bn);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
+    // a block past the old end of the file, or new in a hole,
+    // holds no data yet, so don't read it.
+    if(bn*BSIZE >= size || (bn == first && newfirst) || (bn == last && newlast))
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
@@ -533,7 +1053,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     brelse(bp);
   }
 
-  if(off > ip->size)
+  if(tot > 0 && off > ip->size)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
@@ -544,6 +1064,17 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+struct inodeops diskops = {
+  .ialloc = diskialloc,
+  .iread = diskiread,
+  .iupdate = diskiupdate,
+  .itrunc = diskitrunc,
+  .fallocate = diskfallocate,
+  .readi = diskreadi,
+  .writei = diskwritei,
+  .logged = 1,
+};
+
 // Directories
 
 int
@@ -552,23 +1083,56 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Read the header of the directory entry at off in dp,
+// along with the first n bytes of its name. One readi()
+// gets both, and never reaches into the next block.
+static void
+readent(struct inode *dp, uint off, struct dirent *de, uint n)
+{
+  n = min(DIRHDR + n, BSIZE - off%BSIZE);
+  if(readi(dp, 0, (uint64)de, off, n) < DIRHDR)
+    panic("readent");
+  if(de->reclen < DIRHDR || de->reclen % 4 || off%BSIZE + de->reclen > BSIZE)
+    panic("readent: bad entry");
+}
+
+// Write an entry for (name, inum) at off in dp, taking
+// reclen bytes. Returns -1 if out of disk blocks.
+static int
+writeent(struct inode *dp, uint off, char *name, uint inum, uint reclen)
+{
+  struct dirent de;
+  uint len = strlen(name);
+
+  memset(&de, 0, sizeof(de));
+  de.inum = inum;
+  de.reclen = reclen;
+  de.namelen = len;
+  memmove(de.name, name, len);
+  if(writei(dp, 0, (uint64)&de, off, DIRENTSIZE(len)) != DIRENTSIZE(len))
+    return -1;
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, len;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
+  // only entries with a name of the same length need a
+  // look at the name itself.
+  len = strlen(name);
+  for(off = 0; off < dp->size; off += de.reclen){
+    readent(dp, off, &de, len);
+    if(de.inum == 0 || de.namelen != len)
       continue;
-    if(namecmp(name, de.name) == 0){
+    if(memcmp(name, de.name, len) == 0){
       // entry matches path element
       if(poff)
         *poff = off;
@@ -585,7 +1149,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off, last, need, used, rest;
   struct dirent de;
   struct inode *ip;
 
@@ -595,22 +1159,463 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an unused entry that is big enough, or an entry
+  // with enough free space after its name to split off.
+  need = DIRENTSIZE(strlen(name));
+  last = 0;
+  for(off = 0; off < dp->size; off += de.reclen){
+    readent(dp, off, &de, 0);
+    used = de.inum ? DIRENTSIZE(de.namelen) : 0;
+    if(de.reclen - used >= need){
+      rest = de.reclen - used;
+      if(writeent(dp, off + used, name, inum, rest) < 0)
+        return -1;
+      if(used){
+        de.reclen = used;
+        if(writei(dp, 0, (uint64)&de, off, DIRHDR) != DIRHDR)
+          panic("dirlink: writei");
+      }
+      return 0;
+    }
+    last = off;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  // Append. If the entry doesn't fit in the rest of the last
+  // block, start a new block and give the rest to the last entry.
+  off = dp->size;
+  if(off%BSIZE + need <= BSIZE || off%BSIZE == 0)
+    return writeent(dp, off, name, inum, need);
+  rest = BSIZE - off%BSIZE;
+  if(writeent(dp, off + rest, name, inum, need) < 0)
     return -1;
+  readent(dp, last, &de, 0);
+  de.reclen += rest;
+  if(writei(dp, 0, (uint64)&de, last, DIRHDR) != DIRHDR)
+    panic("dirlink: writei");
+  return 0;
+}
+
+// Name cache
+//
+// namex() would lock each directory on a path in turn. It
+// first tries to walk the path through a cache of directory
+// entries instead, without any locks: the walk is an RCU
+// reader (see rcu.c). Updates take dcache.lock, and an entry
+// they unhash is only reused once a grace period has passed,
+// so a walk never finds one rewritten under it.
+//
+// namex() caches each entry it looks up the slow way, under
+// the directory's lock; unlink removes it, under the same lock
+// held exclusively. Entries are only ever keyed by directories,
+// so a walk that finds an entry in (dev, dir) knows that dir
+// is a directory. Only names of up to DCNAME bytes are cached.
+//
+// A walk can still race with an update: the inode it ends at
+// may have been unlinked and its number reused before iget().
+// Each removal bumps dcache.seq, and a walk during which it
+// changed starts over the slow way.
+
+#define NDCACHE 128  // cached entries
+#define NDCHASH 61   // hash chains
+#define DCNAME  28   // longest name cached
+
+struct dentry {
+  struct dentry *next;  // hash chain; left alone when unhashed
+  struct dentry *link;  // free, retired or waiting list
+  int hashed;           // on a hash chain?
+  uint dev;
+  uint dir;             // inum of the directory
+  uint inum;            // inum of the entry
+  uint len;
+  char name[DCNAME];
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry *hash[NDCHASH];
+  struct dentry *free;
+  struct dentry *retired;  // unhashed, waiting for a grace period to start
+  struct dentry *waiting;  // unhashed, waiting for gp to end
+  struct rcugp gp;
+  uint seq;                // bumped by every removal
+  uint hand;               // next entry for eviction to look at
+  struct dentry ent[NDCACHE];
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+  for(int i = 0; i < NDCACHE; i++){
+    dcache.ent[i].link = dcache.free;
+    dcache.free = &dcache.ent[i];
+  }
+}
+
+static uint
+dchash(uint dev, uint dir, char *name, uint len)
+{
+  uint h = dev * 31 + dir;
+
+  for(uint i = 0; i < len; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDCHASH;
+}
+
+// Find the entry for name in directory (dev, dir).
+// Needs dcache.lock or rcu_read_lock().
+static struct dentry*
+dclookup(uint dev, uint dir, char *name, uint len)
+{
+  struct dentry *d;
+
+  d = *(struct dentry * volatile *)&dcache.hash[dchash(dev, dir, name, len)];
+  for(; d; d = d->next){
+    if(d->dev == dev && d->dir == dir && d->len == len &&
+       memcmp(d->name, name, len) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Return unhashed entries to the free list once their grace
+// period is over, and start one for those retired since.
+// Caller holds dcache.lock.
+static void
+dcreclaim(void)
+{
+  struct dentry *d;
+
+  if(dcache.waiting && rcu_gpdone(&dcache.gp)){
+    while((d = dcache.waiting) != 0){
+      dcache.waiting = d->link;
+      d->link = dcache.free;
+      dcache.free = d;
+    }
+  }
+  if(dcache.waiting == 0 && dcache.retired){
+    dcache.waiting = dcache.retired;
+    dcache.retired = 0;
+    rcu_gpstart(&dcache.gp);
+  }
+}
+
+// Take d off its hash chain. Walks already on d carry on
+// along the chain. Caller holds dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  pp = &dcache.hash[dchash(d->dev, d->dir, d->name, d->len)];
+  while(*pp != d)
+    pp = &(*pp)->next;
+  *pp = d->next;
+  d->hashed = 0;
+  d->link = dcache.retired;
+  dcache.retired = d;
+  dcache.seq++;
+}
+
+// Remember that name in directory dp is inode inum.
+// Caller holds dp->lock, perhaps shared.
+static void
+dcacheinsert(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h, len = strlen(name);
+
+  if(len > DCNAME)
+    return;
+
+  acquire(&dcache.lock);
+  if(dclookup(dp->dev, dp->inum, name, len)){
+    release(&dcache.lock);
+    return;
+  }
+  dcreclaim();
+  if((d = dcache.free) == 0){
+    // evict one entry, to be free for a later insert.
+    for(int i = 0; i < NDCACHE; i++){
+      d = &dcache.ent[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDCACHE;
+      if(d->hashed){
+        dcunhash(d);
+        dcreclaim();
+        break;
+      }
+    }
+    release(&dcache.lock);
+    return;
+  }
+  dcache.free = d->link;
+
+  d->dev = dp->dev;
+  d->dir = dp->inum;
+  d->inum = inum;
+  d->len = len;
+  memmove(d->name, name, len);
+  d->hashed = 1;
+  h = dchash(d->dev, d->dir, name, len);
+  d->next = dcache.hash[h];
+  // fill in d before walks can find it.
+  __sync_synchronize();
+  dcache.hash[h] = d;
+  release(&dcache.lock);
+}
+
+// Forget the entry for name in directory dp, if cached.
+// Caller holds dp->lock exclusively.
+void
+dcacheremove(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dclookup(dp->dev, dp->inum, name, strlen(name))) != 0){
+    dcunhash(d);
+    dcreclaim();
+  }
+  release(&dcache.lock);
+}
+
+// Forget every entry of device dev, and make walks
+// under way start over.
+static void
+dcachedrop(uint dev)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++){
+    if(d->hashed && d->dev == dev)
+      dcunhash(d);
+  }
+  dcache.seq++;
+  dcreclaim();
+  release(&dcache.lock);
+}
+
+// Mounts
+//
+// A mount covers a directory with the root of another file
+// system. The table holds a reference to both inodes, so that
+// each stays in the inode table and can be recognized by
+// address. namex() steps from a covered directory to the
+// mounted root, and from a mounted root back to the covered
+// directory when it follows "..".
+//
+// The root disk is always in use. Other disks are attached
+// by fsattach() when mounted and detached by fsdetach() after
+// they have been unmounted.
+
+struct mount {
+  struct inode *dp;     // covered directory, or 0 if slot free
+  struct inode *root;   // root of the mounted file system
+};
+
+struct {
+  struct spinlock lock;
+  struct mount mount[NMOUNT];
+  char disk[NDISK+1];   // is disk in use?
+} mtable;
+
+void
+mountinit(void)
+{
+  initlock(&mtable.lock, "mtable");
+  mtable.disk[ROOTDEV] = 1;
+}
+
+// Start using the file system on disk dev, in order to mount
+// it. Returns its root directory, or 0 if there is no such
+// disk, it holds no file system, or it is already in use.
+// Must not be called inside a transaction, since replaying
+// the disk's log may have to wait for a commit.
+struct inode*
+fsattach(uint dev)
+{
+  if(dev < 1 || dev > NDISK || !virtio_disk_present(dev))
+    return 0;
+
+  acquire(&mtable.lock);
+  if(mtable.disk[dev]){
+    release(&mtable.lock);
+    return 0;
+  }
+  mtable.disk[dev] = 1;
+  release(&mtable.lock);
+
+  if(fsinit(dev) < 0){
+    acquire(&mtable.lock);
+    mtable.disk[dev] = 0;
+    release(&mtable.lock);
+    return 0;
+  }
+  return iget(dev, ROOTINO);
+}
+
+// Stop using disk dev, whose file system is no longer
+// mounted. Waits for its last transaction to be installed,
+// so must not be called inside a transaction.
+void
+fsdetach(uint dev)
+{
+  detachlog(dev);
+  acquire(&mtable.lock);
+  mtable.disk[dev] = 0;
+  release(&mtable.lock);
+}
+
+// Mount the file system whose root is root on directory dp.
+// Takes over the caller's references to both on success.
+// Returns 0 on success, -1 if dp is already covered or the
+// table is full.
+int
+fsmount(struct inode *dp, struct inode *root)
+{
+  struct mount *m, *empty = 0;
 
+  acquire(&mtable.lock);
+  for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+    if(m->dp == dp){
+      release(&mtable.lock);
+      return -1;
+    }
+    if(empty == 0 && m->dp == 0)
+      empty = m;
+  }
+  if(empty == 0){
+    release(&mtable.lock);
+    return -1;
+  }
+  empty->dp = dp;
+  empty->root = root;
+  release(&mtable.lock);
   return 0;
 }
 
+// Is a file system mounted on directory ip?
+int
+fsmounted(struct inode *ip)
+{
+  struct mount *m;
+  int r = 0;
+
+  acquire(&mtable.lock);
+  for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+    if(m->dp == ip)
+      r = 1;
+  }
+  release(&mtable.lock);
+  return r;
+}
+
+// Unmount the file system whose root directory is ip.
+// Consumes the caller's reference to ip. Returns the
+// device number of the file system, or -1 if ip is not
+// a mounted root or some inode of the file system is
+// still in use (open, or some process's cwd).
+int
+fsunmount(struct inode *ip)
+{
+  struct mount *m;
+  struct inode *dp, *i;
+  uint dev = ip->dev;
+  int busy = 0;
+
+  acquire(&mtable.lock);
+  for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+    if(m->root == ip)
+      break;
+  }
+  if(m == &mtable.mount[NMOUNT]){
+    release(&mtable.lock);
+    iput(ip);
+    return -1;
+  }
+
+  // holding mtable.lock keeps namex() from entering the
+  // file system, so no new references can appear. namefast()
+  // checks dcache.seq under mtable.lock before it returns an
+  // inode it found across a mount; see below.
+  acquire(&itable.lock);
+  for(i = &itable.inode[0]; i < &itable.inode[NINODE]; i++){
+    if(i->ref > 0 && i->dev == dev && (i != ip || i->ref > 2))
+      busy = 1;
+  }
+  release(&itable.lock);
+  if(busy){
+    release(&mtable.lock);
+    iput(ip);
+    return -1;
+  }
+
+  dp = m->dp;
+  m->dp = 0;
+  m->root = 0;
+  // a walk that crossed into the file system, but got its
+  // reference after the check above, must start over.
+  dcachedrop(dev);
+  release(&mtable.lock);
+
+  iput(ip);  // the table's reference
+  iput(ip);  // the caller's
+  iput(dp);
+  return dev;
+}
+
+// If a file system is mounted on ip, return its root
+// instead. Consumes the caller's reference to ip.
+static struct inode*
+mountroot(struct inode *ip)
+{
+  struct mount *m;
+  struct inode *next;
+
+  for(;;){
+    next = 0;
+    acquire(&mtable.lock);
+    for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+      if(m->dp == ip){
+        next = idup(m->root);
+        break;
+      }
+    }
+    release(&mtable.lock);
+    if(next == 0)
+      return ip;
+    iput(ip);
+    ip = next;
+  }
+}
+
+// If ip is the root of a mounted file system, return the
+// directory it covers instead. Consumes the caller's
+// reference to ip.
+static struct inode*
+mountpoint(struct inode *ip)
+{
+  struct mount *m;
+  struct inode *next;
+
+  for(;;){
+    next = 0;
+    acquire(&mtable.lock);
+    for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+      if(m->root == ip){
+        next = idup(m->dp);
+        break;
+      }
+    }
+    release(&mtable.lock);
+    if(next == 0)
+      return ip;
+    iput(ip);
+    ip = next;
+  }
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -639,33 +1644,118 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > DIRSIZ)
+    len = DIRSIZ;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
 }
 
+// mountroot() and, if up is set, mountpoint(), for namefast(),
+// on the inode (*dev, *inum), which it holds no reference to.
+// Reads the mount table without mtable.lock: fsunmount()
+// bumps dcache.seq if it changes the table under the walk.
+// Returns 1 if it crossed a mount.
+static int
+mountcross(uint *dev, uint *inum, int up)
+{
+  struct mount *m;
+  struct inode *from, *to;
+  int n;
+
+  for(n = 0; n < NMOUNT; n++){
+    for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+      from = up ? m->root : m->dp;
+      to = up ? m->dp : m->root;
+      if(from && to && from->dev == *dev && from->inum == *inum)
+        break;
+    }
+    if(m == &mtable.mount[NMOUNT])
+      return n > 0;
+    *dev = to->dev;
+    *inum = to->inum;
+  }
+  return 1;
+}
+
+// Look up path through the name cache, with no locks.
+// Returns the inode with a reference, as namei() does, or 0
+// if some element isn't cached, in which case the caller
+// should look the slow way. name is scratch space.
+static struct inode*
+namefast(char *path, char *name)
+{
+  struct inode *ip;
+  struct dentry *d;
+  uint dev, inum, seq;
+  int crossed = 0, ok;
+
+  rcu_read_lock();
+  seq = dcache.seq;
+  __sync_synchronize();
+
+  if(*path == '/'){
+    dev = ROOTDEV;
+    inum = ROOTINO;
+  } else {
+    dev = myproc()->cwd->dev;
+    inum = myproc()->cwd->inum;
+  }
+
+  while((path = skipelem(path, name)) != 0){
+    if(namecmp(name, "..") == 0)
+      crossed |= mountcross(&dev, &inum, 1);
+    if((d = dclookup(dev, inum, name, strlen(name))) == 0){
+      rcu_read_unlock();
+      return 0;
+    }
+    inum = d->inum;
+    crossed |= mountcross(&dev, &inum, 0);
+  }
+
+  ip = iget(dev, inum);
+  // across a mount, check under mtable.lock: either
+  // fsunmount() hasn't looked for references yet and
+  // will see ours, or it has cleared the mount and
+  // bumped dcache.seq.
+  if(crossed)
+    acquire(&mtable.lock);
+  __sync_synchronize();
+  ok = dcache.seq == seq;
+  if(crossed)
+    release(&mtable.lock);
+  if(!ok){
+    rcu_read_unlock();
+    iput(ip);
+    return 0;
+  }
+  rcu_read_unlock();
+  return ip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for DIRSIZ+1 bytes.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
+  if(!nameiparent && (ip = namefast(path, name)) != 0)
+    return ip;
+
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    if(namecmp(name, "..") == 0)
+      ip = mountpoint(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
@@ -679,8 +1769,12 @@ namex(char *path, int nameiparent, char *name)
       iunlockput(ip);
       return 0;
     }
+    // a directory that is being removed may still be
+    // looked in, but its entries mustn't be cached.
+    if(ip->nlink > 0)
+      dcacheinsert(ip, name, next->inum);
     iunlockput(ip);
-    ip = next;
+    ip = mountroot(next);
   }
   if(nameiparent){
     iput(ip);
@@ -692,7 +1786,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
   return namex(path, 0, name);
 }
 
@@ -6,8 +6,15 @@
 #define BSIZE 1024  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+// [ boot block | super block | log | group 0 | group 1 | ... ]
+//
+// where each block group is
+// [ free bit map block | inode blocks | data blocks ]
+//
+// A group's bit map covers only the blocks of that group, and
+// inode i lives in group i / ipg. The kernel allocates a file's
+// inode in the group of its directory, and its blocks in the
+// group of its inode, so that related inodes and data are close.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -15,11 +22,13 @@ struct superblock {
   uint magic;        // Must be FSMAGIC
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
-  uint ninodes;      // Number of inodes.
+  uint ninodes;      // Number of inodes (ngroups * ipg)
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
-  uint inodestart;   // Block number of first inode block
-  uint bmapstart;    // Block number of first free map block
+  uint groupstart;   // Block number of first block group
+  uint groupsize;    // Blocks per group, at most BPB; the last may be short
+  uint ngroups;      // Number of block groups
+  uint ipg;          // Inodes per group, a multiple of IPB
 };
 
 #define FSMAGIC 0x10203040
@@ -28,9 +37,18 @@ struct superblock {
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
 
+// Bytes of file contents that fit in addrs[].
+#define NINLINE (sizeof(uint) * (NDIRECT+1))
+
+// In the type of an on-disk inode: the file's contents are
+// kept in addrs[] instead of in data blocks. Files and
+// directories start out inline, and move to data blocks
+// when they grow past NINLINE bytes.
+#define DI_INLINE 0x100
+
 // On-disk inode structure
 struct dinode {
-  short type;           // File type
+  short type;           // File type, and DI_INLINE
   short major;          // Major device number (T_DEVICE only)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
@@ -41,20 +59,40 @@ struct dinode {
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
+// First block of group g, which holds its free map
+#define GSTART(g, sb)     ((sb).groupstart + (g) * (sb).groupsize)
+
+// Group of block b, and group of inode i
+#define BGROUP(b, sb)     (((b) - (sb).groupstart) / (sb).groupsize)
+#define IGROUP(i, sb)     ((i) / (sb).ipg)
+
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     (GSTART(IGROUP(i, sb), sb) + 1 + (i) % (sb).ipg / IPB)
 
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
-// Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+// Block of free map containing bit for block b, and the bit
+#define BBLOCK(b, sb) GSTART(BGROUP(b, sb), sb)
+#define BBIT(b, sb)   ((b) - BBLOCK(b, sb))
 
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+// Directory is a file containing a sequence of variable-length
+// directory entries, each a header followed by the name (not
+// NUL-terminated) and padding up to a multiple of 4 bytes.
+// An entry's reclen also covers any free space after it, and
+// never crosses a block boundary. inum is 0 in an unused entry.
+#define DIRSIZ 255
 
 struct dirent {
   ushort inum;
-  char name[DIRSIZ];
+  ushort reclen;        // bytes from this entry to the next
+  ushort namelen;
+  char name[DIRSIZ+3];  // room for the longest name and its padding
 };
 
+// Bytes of struct dirent before the name.
+#define DIRHDR (3 * sizeof(ushort))
+
+// Bytes taken by an entry with an n-byte name.
+#define DIRENTSIZE(n) ((DIRHDR + (n) + 3) & ~3)
+
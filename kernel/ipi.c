@@ -0,0 +1,42 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+//
+// inter-processor interrupts, through the ACLINT
+// supervisor software interrupt device (SSWI).
+//
+// a write to a hart's SETSSIP register raises that hart's
+// supervisor software interrupt without any help from
+// machine mode or an SBI. qemu provides the device with
+// -machine virt,aclint=on.
+//
+
+// interrupt hart. the target takes a supervisor software
+// interrupt as soon as it has interrupts enabled, or leaves
+// wfi right away if it was parked there.
+void
+ipi_send(int hart)
+{
+  __sync_synchronize();
+  *(volatile uint32*)ACLINT_SETSSIP(hart) = 1;
+}
+
+// a supervisor software interrupt arrived.
+// called from devintr() with interrupts off.
+void
+ipi_intr(void)
+{
+  // acknowledge, so the interrupt isn't taken again.
+  w_sip(r_sip() & ~SIP_SSIP);
+
+  mycpu()->nipi++;
+
+  // besides bringing the hart out of wfi in scheduler(),
+  // an IPI may carry a TLB shootdown request.
+  tlb_poll();
+}
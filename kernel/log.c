@@ -28,7 +28,36 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous: a commit starts the writes of
+// all its log blocks at once, waits for them, and then writes
+// the header. The disk may keep completed writes in a volatile
+// write cache, so a cache flush comes between the log blocks and
+// the header (the header must never be durable before they are),
+// and another after the header, before the commit is reported.
+//
+// Committed blocks are not copied to their home locations right
+// away: commit() only marks their cached buffers dirty, and the
+// buffer cache writes them back later. The log therefore keeps
+// several committed transactions, one after another, and a
+// block rewritten by each of them reaches home only once. Once
+// the log is more than half full (or on sync()), a checkpoint
+// writes back all of a disk's dirty blocks and empties its log.
+// Recovery replays the log in order, so the latest copy of a
+// block wins.
+//
+// Blocks that a transaction frees are discarded (the disk is
+// told that they hold nothing worth keeping) after it commits,
+// in runs of adjacent blocks, unless the transaction allocates
+// them again first.
+//
+// Every mounted disk has its own log region, described by a
+// struct devlog. A transaction spans all of them: begin_op()
+// reserves MAXOPBLOCKS in every log, log_write() records the
+// block in the log of its device, and commit() commits each
+// device's log in turn. Disks are separate file systems, so
+// nothing needs to be atomic across devices.
+
+#define NDISCARD 16 // freed runs of blocks a devlog keeps for discarding
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -38,64 +67,147 @@ struct logheader
     int block[LOGSIZE];
 };
 
-struct log
+// The log region of one disk.
+struct devlog
 {
-    struct spinlock lock;
+    int active; // disk is mounted; part of every transaction.
+    int dev;
     int start;
     int size;
+    int committed; // lh.block[0..committed) belong to committed transactions.
+    struct logheader lh;
+
+    // runs of blocks that the open transaction freed.
+    struct
+    {
+        uint start;
+        uint n;
+    } discard[NDISCARD];
+    int ndiscard;
+    int discardlost; // freed blocks that didn't fit in discard[]
+};
+
+struct log
+{
+    struct spinlock lock;
     int outstanding; // how many FS sys calls are executing.
     int committing;  // in commit(), please wait.
-    int dev;
-    struct logheader lh;
+    int ncommit;     // number of commits so far.
+    int wantcheckpoint; // next commit should also checkpoint.
+    struct devlog dl[NDISK];
 };
 struct log log;
 
-static void recover_from_log(void);
+static void recover_from_log(struct devlog *dl);
+static void write_head(struct devlog *dl);
 static void commit();
 
-void initlog(int dev, struct superblock *sb)
+void loginit(void)
 {
     if (sizeof(struct logheader) >= BSIZE)
         panic("initlog: too big logheader");
 
     initlock(&log.lock, "log");
-    log.start = sb->logstart;
-    log.size = sb->nlog;
-    log.dev = dev;
-    recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
-static void install_trans(int recovering)
+// Start logging for disk dev, whose super block is sb,
+// first replaying any transaction committed before a crash.
+void initlog(int dev, struct superblock *sb)
+{
+    struct devlog *dl = &log.dl[dev - 1];
+
+    if (dl->active)
+        panic("initlog: in use");
+    dl->dev = dev;
+    dl->start = sb->logstart;
+    dl->size = sb->nlog;
+    recover_from_log(dl);
+
+    acquire(&log.lock);
+    dl->active = 1;
+    release(&log.lock);
+}
+
+// Stop logging for disk dev, once its last
+// transaction has been installed.
+void detachlog(int dev)
+{
+    struct devlog *dl = &log.dl[dev - 1];
+
+    for (;;)
+    {
+        log_sync(1);
+        acquire(&log.lock);
+        if (!log.committing && dl->lh.n == 0)
+            break;
+        release(&log.lock);
+    }
+    dl->active = 0;
+    release(&log.lock);
+}
+
+// The log of the disk holding b.
+static struct devlog *devlog(struct buf *b)
+{
+    if (b->dev < 1 || b->dev > NDISK || !log.dl[b->dev - 1].active)
+        panic("log: disk not mounted");
+    return &log.dl[b->dev - 1];
+}
+
+// Copy committed blocks from log to their home location,
+// during recovery.
+static void install_trans(struct devlog *dl)
 {
     int tail;
 
-    for (tail = 0; tail < log.lh.n; tail++)
+    for (tail = 0; tail < dl->lh.n; tail++)
     {
-        struct buf *lbuf = bread(log.dev, log.start + tail + 1); // read log block
-        struct buf *dbuf = bread(log.dev, log.lh.block[tail]);   // read dst
+        struct buf *lbuf = bread(dl->dev, dl->start + tail + 1); // read log block
+        struct buf *dbuf = bnew(dl->dev, dl->lh.block[tail]);    // dst
         memmove(dbuf->data, lbuf->data, BSIZE);                  // copy block to dst
-        bwrite(dbuf);                                            // write dst to disk
+        brelse(lbuf);
+        bwriteasync(dbuf); // write dst to disk
+    }
+    bwaitall();
+}
 
-        if (recovering == 0)
-            bunpin(dbuf);
+// The transaction just committed: leave its blocks in the
+// cache, marked dirty, for the buffer cache to write back.
+static void release_trans(struct devlog *dl)
+{
+    int tail;
 
-        brelse(lbuf);
-        brelse(dbuf);
+    for (tail = dl->committed; tail < dl->lh.n; tail++)
+    {
+        struct buf *b = bread(dl->dev, dl->lh.block[tail]); // pinned, so cached
+        b->txn = 0;
+        bdirty(b);
+        bunpin(b);
+        brelse(b);
     }
+    dl->committed = dl->lh.n;
+}
+
+// Write back every committed block of the disk and empty its log.
+static void checkpoint(struct devlog *dl)
+{
+    bflush(dl->dev);
+    dl->lh.n = 0;
+    dl->committed = 0;
+    write_head(dl);
 }
 
 // Read the log header from disk into the in-memory log header
-static void read_head(void)
+static void read_head(struct devlog *dl)
 {
-    struct buf *buf = bread(log.dev, log.start);
+    struct buf *buf = bread(dl->dev, dl->start);
     struct logheader *lh = (struct logheader *)(buf->data);
     int i;
-    log.lh.n = lh->n;
+    dl->lh.n = lh->n;
 
-    for (i = 0; i < log.lh.n; i++)
+    for (i = 0; i < dl->lh.n; i++)
     {
-        log.lh.block[i] = lh->block[i];
+        dl->lh.block[i] = lh->block[i];
     }
 
     brelse(buf);
@@ -103,29 +215,48 @@ static void read_head(void)
 
 // Write in-memory log header to disk.
 // This is the true point at which the
-// current transaction commits.
+// current transaction commits. Every write
+// that completed before is made durable
+// first, and the header itself after.
 static void
-write_head(void)
+write_head(struct devlog *dl)
 {
-    struct buf *buf = bread(log.dev, log.start);
+    struct buf *buf = bread(dl->dev, dl->start);
     struct logheader *hb = (struct logheader *)(buf->data);
     int i;
-    hb->n = log.lh.n;
-    for (i = 0; i < log.lh.n; i++)
+    hb->n = dl->lh.n;
+    for (i = 0; i < dl->lh.n; i++)
     {
-        hb->block[i] = log.lh.block[i];
+        hb->block[i] = dl->lh.block[i];
     }
-    bwrite(buf);
+    bbarrier(dl->dev);
+    bwritepoll(buf);
     brelse(buf);
+    bbarrier(dl->dev);
 }
 
 static void
-recover_from_log(void)
+recover_from_log(struct devlog *dl)
+{
+    read_head(dl);
+    install_trans(dl); // if committed, copy from log to disk
+    dl->lh.n = 0;
+    dl->committed = 0;
+    write_head(dl); // clear the log
+}
+
+// Might one more operation overflow some disk's log?
+// Caller holds log.lock.
+static int
+logfull(void)
 {
-    read_head();
-    install_trans(1); // if committed, copy from log to disk
-    log.lh.n = 0;
-    write_head(); // clear the log
+    for (int i = 0; i < NDISK; i++)
+    {
+        struct devlog *dl = &log.dl[i];
+        if (dl->active && dl->lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE)
+            return 1;
+    }
+    return 0;
 }
 
 // called at the start of each FS system call.
@@ -138,7 +269,7 @@ void begin_op(void)
         {
             sleep(&log, &log.lock);
         }
-        else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE)
+        else if (logfull())
         {
             // this op might exhaust log space; wait for commit.
             sleep(&log, &log.lock);
@@ -186,39 +317,95 @@ void end_op(void)
         commit();
         acquire(&log.lock);
         log.committing = 0;
+        log.ncommit++;
         wakeup(&log);
         release(&log.lock);
     }
 }
 
-// Copy modified blocks from cache to log.
+// Wait until the updates of every FS system call that has
+// finished are committed. With full set, also write
+// back all committed blocks, so that the logs are empty.
+void log_sync(int full)
+{
+    int n;
+
+    acquire(&log.lock);
+    while (log.committing)
+        sleep(&log, &log.lock);
+    if (full)
+        log.wantcheckpoint = 1;
+
+    if (log.outstanding > 0)
+    {
+        // the open transaction commits when the last of
+        // the outstanding calls ends.
+        n = log.ncommit;
+        while (log.ncommit == n)
+            sleep(&log, &log.lock);
+    }
+    else
+    {
+        // no transaction is open; commit now.
+        log.committing = 1;
+        release(&log.lock);
+        commit();
+        acquire(&log.lock);
+        log.committing = 0;
+        log.ncommit++;
+        wakeup(&log);
+    }
+    release(&log.lock);
+}
+
+// Copy the open transaction's blocks from cache to log,
+// with all the log writes in flight at once.
 static void
-write_log(void)
+write_log(struct devlog *dl)
 {
     int tail;
 
-    for (tail = 0; tail < log.lh.n; tail++)
+    for (tail = dl->committed; tail < dl->lh.n; tail++)
     {
-        struct buf *to = bread(log.dev, log.start + tail + 1); // log block
-        struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+        struct buf *to = bnew(dl->dev, dl->start + tail + 1);   // log block
+        struct buf *from = bread(dl->dev, dl->lh.block[tail]); // cache block
         memmove(to->data, from->data, BSIZE);
-        bwrite(to); // write the log
         brelse(from);
-        brelse(to);
+        bwriteasync(to); // write the log
     }
+    bwaitall();
+}
+
+// Tell the disk about the blocks that the transaction
+// that just committed freed.
+static void
+discard_trans(struct devlog *dl)
+{
+    for (int i = 0; i < dl->ndiscard; i++)
+        bdiscard(dl->dev, dl->discard[i].start, dl->discard[i].n);
+    dl->ndiscard = 0;
+    dl->discardlost = 0;
 }
 
 static void
 commit()
 {
-    if (log.lh.n > 0)
+    for (int i = 0; i < NDISK; i++)
     {
-        write_log();      // Write modified blocks from cache to log
-        write_head();     // Write header to disk -- the real commit
-        install_trans(0); // Now install writes to home locations
-        log.lh.n = 0;
-        write_head(); // Erase the transaction from the log
+        struct devlog *dl = &log.dl[i];
+        if (!dl->active)
+            continue;
+        if (dl->lh.n > dl->committed)
+        {
+            write_log(dl);     // Write modified blocks from cache to log
+            write_head(dl);    // Write header to disk -- the real commit
+            release_trans(dl); // Leave home writes to the buffer cache
+        }
+        discard_trans(dl);
+        if (dl->lh.n > 0 && (log.wantcheckpoint || dl->lh.n > LOGSIZE / 2))
+            checkpoint(dl);
     }
+    log.wantcheckpoint = 0;
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -233,23 +420,126 @@ commit()
 void log_write(struct buf *b)
 {
     int i;
+    struct devlog *dl;
 
     acquire(&log.lock);
-    if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+    dl = devlog(b);
+    if (dl->lh.n >= LOGSIZE || dl->lh.n >= dl->size - 1)
         panic("too big a transaction");
     if (log.outstanding < 1)
         panic("log_write outside of trans");
 
-    for (i = 0; i < log.lh.n; i++)
+    for (i = dl->committed; i < dl->lh.n; i++)
     {
-        if (log.lh.block[i] == b->blockno) // log absorption
+        if (dl->lh.block[i] == b->blockno) // log absorption
             break;
     }
-    log.lh.block[i] = b->blockno;
-    if (i == log.lh.n)
+    dl->lh.block[i] = b->blockno;
+    if (i == dl->lh.n)
     { // Add new block to log?
         bpin(b);
-        log.lh.n++;
+        b->txn = 1;
+        dl->lh.n++;
+    }
+    release(&log.lock);
+}
+
+// The current transaction freed block blockno of disk dev:
+// remember to discard it once the transaction commits. A block
+// next to a remembered run joins it; if there are too many runs,
+// the block is just not discarded.
+void log_discard(uint dev, uint blockno)
+{
+    struct devlog *dl = &log.dl[dev - 1];
+    int i;
+
+    acquire(&log.lock);
+    for (i = 0; i < dl->ndiscard; i++)
+    {
+        if (dl->discard[i].start + dl->discard[i].n == blockno)
+            break;
+        if (blockno + 1 == dl->discard[i].start)
+        {
+            dl->discard[i].start--;
+            break;
+        }
+    }
+    if (i < dl->ndiscard)
+        dl->discard[i].n++;
+    else if (dl->ndiscard < NDISCARD)
+    {
+        dl->discard[i].start = blockno;
+        dl->discard[i].n = 1;
+        dl->ndiscard++;
+    }
+    else
+        dl->discardlost = 1;
+    release(&log.lock);
+}
+
+// The current transaction allocated blocks [blockno, blockno+n)
+// of disk dev: take them out of the runs to be discarded.
+// Returns 1 if the transaction may have freed some of them
+// itself, so that the last commit still gives them to their
+// old owner; 0 if they were free when it started.
+int log_undiscard(uint dev, uint blockno, uint n)
+{
+    struct devlog *dl = &log.dl[dev - 1];
+    uint s, e;
+    int i, freed;
+
+    acquire(&log.lock);
+    freed = dl->discardlost;
+    for (i = 0; i < dl->ndiscard; i++)
+    {
+        s = dl->discard[i].start;
+        e = s + dl->discard[i].n;
+        if (e <= blockno || blockno + n <= s)
+            continue;
+        freed = 1;
+        if (s < blockno)
+        {
+            // keep the part before; the part after, if any,
+            // needs a run of its own.
+            dl->discard[i].n = blockno - s;
+            if (blockno + n < e && dl->ndiscard < NDISCARD)
+            {
+                dl->discard[dl->ndiscard].start = blockno + n;
+                dl->discard[dl->ndiscard].n = e - (blockno + n);
+                dl->ndiscard++;
+            }
+        }
+        else if (blockno + n < e)
+        {
+            dl->discard[i].start = blockno + n;
+            dl->discard[i].n = e - (blockno + n);
+        }
+        else
+        {
+            dl->discard[i--] = dl->discard[--dl->ndiscard];
+        }
+    }
+    release(&log.lock);
+    return freed;
+}
+
+// Does the log of disk dev hold a copy of block blockno, that
+// recovery would write back? Then the block must only change
+// through the log.
+int log_holds(uint dev, uint blockno)
+{
+    struct devlog *dl = &log.dl[dev - 1];
+    int i, r = 0;
+
+    acquire(&log.lock);
+    for (i = 0; i < dl->lh.n; i++)
+    {
+        if (dl->lh.block[i] == blockno)
+        {
+            r = 1;
+            break;
+        }
     }
     release(&log.lock);
+    return r;
 }
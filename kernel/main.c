@@ -63,10 +63,17 @@ void main()
     plicinit();         // set up interrupt controller
     plicinithart();     // ask PLIC for device interrupts
     binit();            // buffer cache
+    loginit();          // log
     iinit();            // inode table
+    mountinit();        // mount table
+    tmpfsinit();        // in-memory file systems
     fileinit();         // file table
-    virtio_disk_init(); // emulated hard disk
+#ifdef RAMDISK
+    ramdiskinit();      // root file system image in memory
+#endif
+    virtio_disk_init(); // emulated hard disks
     userinit();         // first user process
+    kthread("flusher", bflusher); // write back dirty buffers
 
     printf("\nhart %d started\n", cpuid());
     __sync_synchronize();
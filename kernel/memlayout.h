@@ -5,9 +5,11 @@
 //
 // 00001000 -- boot ROM, provided by qemu
 // 02000000 -- CLINT
+// 02F00000 -- ACLINT SSWI (with -machine virt,aclint=on)
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
 // 10001000 -- virtio disk 
+// 10002000 -- ... up to NDISK virtio mmio slots, 0x1000 apart
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
 // unused RAM after 80000000.
@@ -24,6 +26,14 @@
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO(n) (VIRTIO0 + (n)*0x1000L)  // slot n, 0 <= n < NDISK
+#define VIRTIO_IRQ(n) (VIRTIO0_IRQ + (n))
+
+// ACLINT supervisor-level software interrupt device.
+// writing 1 to a hart's SETSSIP register raises that hart's
+// supervisor software interrupt.
+#define ACLINT_SSWI 0x2F00000L
+#define ACLINT_SETSSIP(hart) (ACLINT_SSWI + 4*(hart))
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
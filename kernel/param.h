@@ -1,15 +1,23 @@
-#define NPROC        64  // maximum number of processes
-#define NCPU          8  // maximum number of CPUs
+#define NPROC       128  // maximum number of processes
+#define NCPU         64  // maximum number of CPUs
+#define CACHELINE    64  // bytes per cache line, for per-CPU data
 #define NOFILE       16  // open files per process
+#define NSHARED       4  // sleeplocks a process may hold shared at once
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NDISK         8  // disks are device numbers 1..NDISK
+#define NDISKQ        4  // maximum virtio queues per disk
+#define TMPDEV      100  // device number of the first tmpfs mount
+#define NTMPINODE   200  // maximum number of tmpfs i-nodes
+#define NMOUNT        8  // maximum number of mounts
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*10) // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
-#define MAXPATH      128   // maximum file path name
+#define MAXPATH      512   // maximum file path name
+#define DISKPOLL     20    // microseconds a polled disk request spins before sleeping
 #define USERSTACK    1     // user stack pages
 
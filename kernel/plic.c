@@ -13,7 +13,8 @@ plicinit(void)
 {
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
-  *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+  for(int n = 0; n < NDISK; n++)
+    *(uint32*)(PLIC + VIRTIO_IRQ(n)*4) = 1;
 }
 
 void
@@ -22,8 +23,11 @@ plicinithart(void)
   int hart = cpuid();
   
   // set enable bits for this hart's S-mode
-  // for the uart and virtio disk.
-  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  // for the uart and virtio disks.
+  uint32 enable = (1 << UART0_IRQ);
+  for(int n = 0; n < NDISK; n++)
+    enable |= (1 << VIRTIO_IRQ(n));
+  *(uint32*)PLIC_SENABLE(hart) = enable;
 
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
@@ -8,6 +8,10 @@
 
 struct cpu cpus[NCPU];
 
+// Harts that have entered scheduler(), one bit per cpuid().
+// Affinity masks are clipped to this set.
+volatile uint64 cpuonline;
+
 struct proc proc[NPROC];
 
 struct proc *initproc;
@@ -16,7 +20,10 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void kick(struct proc *p);
+static int anyrunnable(uint64 mask);
 
 extern char trampoline[]; // trampoline.S
 
@@ -123,6 +130,8 @@ static struct proc* allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->affinity = ~(uint64)0;
+  p->cpu = -1;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -167,6 +176,10 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->affinity = 0;
+  p->cpu = -1;
+  p->readytime = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -252,6 +265,23 @@ void userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread: a process that runs fn() in the
+// kernel and never goes to user space. fn must not return.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -316,8 +346,14 @@ fork(void)
   np->parent = p;
   release(&wait_lock);
 
+  acquire(&p->lock);
+  uint64 affinity = p->affinity;
+  release(&p->lock);
+
   acquire(&np->lock);
+  np->affinity = affinity;
   np->state = RUNNABLE;
+  kick(np);
   release(&np->lock);
 
   return pid;
@@ -439,43 +475,121 @@ wait(uint64 addr)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// Only processes whose affinity mask includes this CPU are
+// considered. Processes that last ran here (or never ran) are
+// preferred, so they find their cache state still warm; another
+// CPU's processes are taken only when there is nothing of our own.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 me = CPUBIT(id);
+
+  __sync_fetch_and_or(&cpuonline, me);
 
   c->proc = 0;
   for(;;){
+    // No RCU reader is active on this cpu here.
+    c->nqs++;
+
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
     int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+    for(int steal = 0; steal < 2 && found == 0; steal++){
+      for(p = proc; p < &proc[NPROC]; p++) {
+        acquire(&p->lock);
+        if(p->state == RUNNABLE && (p->affinity & me) &&
+           (steal || p->cpu == id || p->cpu < 0)) {
+          // Switch to chosen process.  It is the process's job
+          // to release its lock and then reacquire it
+          // before jumping back to us.
+          p->state = RUNNING;
+          p->cpu = id;
+          if(p->readytime){
+            c->nwake++;
+            c->waketime += r_time() - p->readytime;
+            p->readytime = 0;
+          }
+          c->proc = p;
+          c->pagetable = p->pagetable;
+          swtch(&c->context, &p->context);
+
+          // Process is done running for now.
+          // It should have changed its p->state before coming back.
+          c->proc = 0;
+          c->pagetable = 0;
+          c->nqs++;
+          found = 1;
+        }
+        release(&p->lock);
       }
-      release(&p->lock);
     }
     if(found == 0) {
       // nothing to run; stop running on this core until an interrupt.
-      intr_on();
-      asm volatile("wfi");
+      // first advertise that we are idle, so that wakeup() sends an
+      // IPI rather than leaving us parked until the next timer
+      // interrupt, then look once more in case a process became
+      // RUNNABLE before the flag was visible. wfi returns for a
+      // pending interrupt even with interrupts off.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      if(!anyrunnable(me))
+        asm volatile("wfi");
+      c->idle = 0;
+    }
+  }
+}
+
+// Is some process that may run on the cpus in mask RUNNABLE?
+// Reads without locks; only a hint for the idle loop.
+static int
+anyrunnable(uint64 mask)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    if(p->state == RUNNABLE && (p->affinity & mask))
+      return 1;
+  }
+  return 0;
+}
+
+// p just became RUNNABLE. If a cpu that may run it is parked in
+// wfi, send that cpu an IPI so it schedules p now instead of at
+// its next timer interrupt. Prefer the cpu p last ran on.
+// Caller must hold p->lock.
+static void
+kick(struct proc *p)
+{
+  uint64 allowed;
+  int target = -1;
+
+  // pairs with the fence in scheduler(): make p's RUNNABLE
+  // state visible before reading idle, so that either we see
+  // the idle flag or the idle hart's anyrunnable() sees p.
+  __sync_synchronize();
+  allowed = p->affinity & cpuonline;
+
+  if(p->cpu >= 0 && (allowed & CPUBIT(p->cpu)) && cpus[p->cpu].idle){
+    target = p->cpu;
+  } else {
+    for(int id = 0; id < NCPU; id++){
+      if((allowed & CPUBIT(id)) && cpus[id].idle){
+        target = id;
+        break;
+      }
     }
   }
+
+  // whoever clears idle first sends the one IPI.
+  if(target >= 0 && __sync_lock_test_and_set(&cpus[target].idle, 0))
+    ipi_send(target);
 }
 
 // Switch to scheduler.  Must hold only p->lock
@@ -530,7 +644,8 @@ forkret(void)
     // File system initialization must be run in the context of a
     // regular process (e.g., because it calls sleep), and thus cannot
     // be run from main().
-    fsinit(ROOTDEV);
+    if(fsinit(ROOTDEV) < 0)
+      panic("invalid file system");
 
     first = 0;
     // ensure other cores see first=0.
@@ -540,6 +655,20 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
@@ -582,6 +711,30 @@ wakeup(void *chan)
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
         p->state = RUNNABLE;
+        p->readytime = r_time();
+        kick(p);
+      }
+      release(&p->lock);
+    }
+  }
+}
+
+// Wake up one process sleeping on chan, if there is one.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++) {
+    if(p != myproc()){
+      acquire(&p->lock);
+      if(p->state == SLEEPING && p->chan == chan) {
+        p->state = RUNNABLE;
+        p->readytime = r_time();
+        kick(p);
+        release(&p->lock);
+        return;
       }
       release(&p->lock);
     }
@@ -603,6 +756,48 @@ kill(int pid)
       if(p->state == SLEEPING){
         // Wake process from sleep().
         p->state = RUNNABLE;
+        p->readytime = r_time();
+        kick(p);
+      }
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Restrict the process with the given pid (0 means the caller)
+// to the harts in mask. Harts that never came online are ignored.
+// If the caller excludes the hart it is running on, it yields
+// so that an allowed hart picks it up.
+// Returns 0 on success, -1 if pid is unknown or mask names no
+// online hart.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  struct proc *me = myproc();
+
+  mask &= cpuonline;
+  if(mask == 0)
+    return -1;
+
+  if(pid == 0)
+    pid = me->pid;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      p->affinity = mask;
+      // an idle cpu the new mask allows may have to run p now.
+      if(p->state == RUNNABLE)
+        kick(p);
+      if(p == me && (mask & CPUBIT(cpuid())) == 0){
+        // yield() to a cpu we may run on, and wake one up.
+        p->state = RUNNABLE;
+        kick(p);
+        sched();
       }
       release(&p->lock);
       return 0;
@@ -612,6 +807,31 @@ kill(int pid)
   return -1;
 }
 
+// Copy the affinity mask of the process with the given pid
+// (0 means the caller) to user address addr.
+// Returns 0 on success, -1 if pid is unknown or addr is bad.
+int
+getaffinity(int pid, uint64 addr)
+{
+  struct proc *p;
+  struct proc *me = myproc();
+  uint64 mask;
+
+  if(pid == 0)
+    pid = me->pid;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      mask = p->affinity & cpuonline;
+      release(&p->lock);
+      return copyout(me->pagetable, addr, (char *)&mask, sizeof(mask));
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -690,3 +910,25 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Print per-cpu scheduler statistics to the console.
+// Runs when user types ^T on console.
+// No lock, like procdump().
+void
+schedstat(void)
+{
+  struct cpu *c;
+
+  printf("\ncpu  ipis  wakeups  avg wake-to-run (us)"
+         "  shootdowns  shootdown ipis  avg shootdown (us)\n");
+  for(int id = 0; id < NCPU; id++){
+    if((cpuonline & CPUBIT(id)) == 0)
+      continue;
+    c = &cpus[id];
+    // r_time() counts at 10 MHz on qemu's virt machine.
+    printf("%d  %ld  %ld  %ld  %ld  %ld  %ld\n", id, c->nipi, c->nwake,
+           c->nwake ? c->waketime / c->nwake / 10 : 0,
+           c->ntlbshoot, c->ntlbipi,
+           c->ntlbshoot ? c->tlbtime / c->ntlbshoot / 10 : 0);
+  }
+}
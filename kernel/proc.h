@@ -19,14 +19,33 @@ struct context {
 };
 
 // Per-CPU state.
+// Each entry gets cache lines of its own: proc, noff and intena
+// are written on every context switch and lock acquire, and
+// must not false-share with a neighbouring hart's entry.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
-};
+  int idle;                   // Parked in wfi; wakeup() should send an IPI.
+  pagetable_t pagetable;      // User page table of the running process, or 0.
+  int tlbpending;             // tlb_shootdown() wants this cpu to flush.
+  uint64 nqs;                 // Quiescent states passed, for rcu.c.
+
+  // scheduler statistics, printed by schedstat().
+  uint64 nipi;                // IPIs received.
+  uint64 nwake;               // Woken processes this cpu went on to run.
+  uint64 waketime;            // Sum of their wakeup-to-run times, in r_time() units.
+  uint64 ntlbshoot;           // TLB shootdowns this cpu started.
+  uint64 ntlbipi;             // IPIs those shootdowns sent.
+  uint64 tlbtime;             // Time spent in them, in r_time() units.
+} __attribute__((aligned(CACHELINE)));
 
 extern struct cpu cpus[NCPU];
+extern volatile uint64 cpuonline;  // CPUBIT()s of harts in scheduler()
+
+// Affinity mask bit for hart id.
+#define CPUBIT(id) ((uint64)1 << (id))
 
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
@@ -91,6 +110,9 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 affinity;             // Harts this process may run on, one bit per cpuid()
+  int cpu;                     // Hart this process last ran on, or -1
+  uint64 readytime;            // r_time() when wakeup() made it RUNNABLE, or 0
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -103,5 +125,7 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct sleeplock *shared[NSHARED]; // Sleeplocks held shared
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Body of a kernel thread, or 0
 };
@@ -0,0 +1,56 @@
+//
+// RAM disk, for running the file system without virtio.
+//
+// with make RAMDISK=1 the Makefile links fs.img into the kernel
+// image, and bio.c sends the root disk's block reads and writes
+// here instead of to virtio_disk.c. the image is used in place,
+// so writes last until reboot. requests complete at once, with
+// a memmove; this measures the cost of the file system layers
+// without the cost of the device.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+
+// fs.img, as linked in by objcopy -I binary.
+extern char _binary_fs_img_start[];
+extern char _binary_fs_img_end[];
+
+static struct {
+  char *data;
+  uint nblocks;
+} ramdisk;
+
+void
+ramdiskinit(void)
+{
+  ramdisk.data = _binary_fs_img_start;
+  ramdisk.nblocks = (_binary_fs_img_end - _binary_fs_img_start) / BSIZE;
+  if(ramdisk.nblocks == 0)
+    panic("ramdiskinit: no image");
+}
+
+// same interface as virtio_disk_rw(), without poll: a copy
+// is done before it returns.
+// the caller holds b->lock, and the buffer cache holds at
+// most one buf per block, so no other lock is needed.
+void
+ramdiskrw(struct buf *b, int write)
+{
+  char *p;
+
+  if(b->blockno >= ramdisk.nblocks)
+    panic("ramdiskrw: blockno");
+  p = ramdisk.data + (uint64)b->blockno * BSIZE;
+  if(write)
+    memmove(p, b->data, BSIZE);
+  else
+    memmove(b->data, p, BSIZE);
+}
@@ -0,0 +1,73 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "rcu.h"
+#include "defs.h"
+
+//
+// read-copy update, for data that is read far more often
+// than it is written.
+//
+// readers take no locks: they bracket their accesses with
+// rcu_read_lock() and rcu_read_unlock(), which only turn
+// interrupts off, so a reader can't be switched away from
+// its hart and must not sleep. an updater unlinks an object
+// under whatever lock protects updates, and may reuse it only
+// after a grace period, once every reader that could have seen
+// it is done.
+//
+// a hart that passes through scheduler() is between read-side
+// critical sections: scheduler() counts these quiescent states
+// in cpu->nqs. a grace period is over once every other online
+// hart's count has moved, or it sits idle in scheduler(). the
+// updater's own hart needs no check, since it isn't reading.
+//
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// start a grace period, for objects the caller has just
+// unlinked.
+void
+rcu_gpstart(struct rcugp *gp)
+{
+  // make the unlinking visible before sampling the counts.
+  __sync_synchronize();
+  for(int id = 0; id < NCPU; id++)
+    gp->nqs[id] = cpus[id].nqs;
+}
+
+// is grace period gp over? doesn't wait.
+int
+rcu_gpdone(struct rcugp *gp)
+{
+  int me, done = 1;
+
+  push_off();
+  me = cpuid();
+  for(int id = 0; id < NCPU; id++){
+    if(id == me || (cpuonline & CPUBIT(id)) == 0)
+      continue;
+    if(*(volatile int*)&cpus[id].idle)
+      continue;
+    if(*(volatile uint64*)&cpus[id].nqs == gp->nqs[id]){
+      done = 0;
+      break;
+    }
+  }
+  pop_off();
+  __sync_synchronize();
+  return done;
+}
@@ -0,0 +1,5 @@
+// A grace period, for rcu.c: it is over once every hart
+// has been through a quiescent state since rcu_gpstart().
+struct rcugp {
+  uint64 nqs[NCPU];   // each hart's cpu->nqs when it started
+};
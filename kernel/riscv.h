@@ -65,6 +65,8 @@ static inline void w_sstatus(uint64 x)
 }
 
 // Supervisor Interrupt Pending
+#define SIP_SSIP (1L << 1) // Software interrupt pending
+
 static inline uint64 r_sip()
 {
   uint64 x;
@@ -310,6 +312,12 @@ static inline void sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// Flush the TLB entries for one virtual address
+static inline void sfence_vma_page(uint64 va)
+{
+  asm volatile("sfence.vma %0, zero" : : "r"(va) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -16,30 +16,143 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->nwaiters = 0;
+  lk->readers = 0;
+  lk->nrwaiters = 0;
 }
 
+// Is o still holding lk, and running on another hart?
+// Reads without locks: the answer is only a hint.
+static int
+ownerrunning(struct sleeplock *lk, struct proc *o)
+{
+  return *(volatile uint *)&lk->locked &&
+         *(struct proc * volatile *)&lk->owner == o &&
+         *(volatile enum procstate *)&o->state == RUNNING;
+}
+
+// Acquire lk exclusively. While its holder is running on
+// another hart, spin: it will likely release lk sooner than
+// a sleep and a wakeup would take. Otherwise (or while
+// readers hold it), sleep until it is released.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+  struct proc *o;
+
   acquire(&lk->lk);
-  while (lk->locked) {
+  while (lk->locked || lk->readers > 0) {
+    o = lk->owner;
+    if (o && o != p && o->state == RUNNING) {
+      release(&lk->lk);
+      while (ownerrunning(lk, o))
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nwaiters++;
     sleep(lk, &lk->lk);
+    lk->nwaiters--;
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->pid = p->pid;
+  lk->owner = p;
   release(&lk->lk);
 }
 
+// Release lk, held exclusively. Wake all the processes
+// asleep waiting to share it, and one of those waiting for
+// it exclusively; that one wakes another when it releases lk.
+// May be called from an interrupt, for a lock handed off
+// with disownsleep().
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  if (lk->nrwaiters > 0)
+    wakeup(&lk->readers);
+  if (lk->nwaiters > 0)
+    wakeone(lk);
+  release(&lk->lk);
+}
+
+// Acquire lk shared, alongside other readers. Spins or
+// sleeps like acquiresleep() while lk is held exclusively.
+// Once a process waits for lk exclusively, new readers
+// wait too, so that a stream of readers can't starve it.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  struct proc *o;
+  int i;
+
+  // note lk among the locks p holds shared.
+  for (i = 0; i < NSHARED && p->shared[i]; i++)
+    ;
+  if (i == NSHARED)
+    panic("acquiresleepshared: too many");
+  p->shared[i] = lk;
+
+  acquire(&lk->lk);
+  while (lk->locked || (lk->readers > 0 && lk->nwaiters > 0)) {
+    o = lk->owner;
+    if (lk->locked && o && o->state == RUNNING) {
+      release(&lk->lk);
+      while (ownerrunning(lk, o))
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nrwaiters++;
+    sleep(&lk->readers, &lk->lk);
+    lk->nrwaiters--;
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Release lk, held shared by this process. The last reader
+// out wakes one process waiting for lk exclusively.
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i;
+
+  for (i = 0; i < NSHARED && p->shared[i] != lk; i++)
+    ;
+  if (i == NSHARED)
+    panic("releasesleepshared");
+  p->shared[i] = 0;
+
+  acquire(&lk->lk);
+  if (lk->readers < 1)
+    panic("releasesleepshared");
+  if (--lk->readers == 0 && lk->nwaiters > 0)
+    wakeone(lk);
+  release(&lk->lk);
+}
+
+// Leave lk held, but by no process: an interrupt handler
+// will release it (e.g. a buffer under asynchronous I/O).
+// Waiters then sleep rather than spin behind a holder
+// that has moved on to other work.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->pid = 0;
+  lk->owner = 0;
   release(&lk->lk);
 }
 
+// Is lk held exclusively, by this process?
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -51,5 +164,14 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Is lk held shared, by this process?
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
 
-
+  for (int i = 0; i < NSHARED; i++)
+    if (p->shared[i] == lk)
+      return 1;
+  return 0;
+}
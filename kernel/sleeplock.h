@@ -1,7 +1,12 @@
-// Long-term locks for processes
+// Long-term locks for processes, held either by one
+// process (exclusive) or by any number of readers (shared).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock, or 0 if handed off
+  int nwaiters;       // Processes asleep waiting for it exclusively
+  int readers;        // Processes holding it shared
+  int nrwaiters;      // Processes asleep waiting for it shared
   
   // For debugging:
   char *name;        // Name of lock.
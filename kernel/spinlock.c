@@ -29,8 +29,10 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  // Interrupts are off, so answer TLB shootdowns while
+  // spinning; the holder may be waiting for this cpu.
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    tlb_poll();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
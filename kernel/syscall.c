@@ -118,6 +118,15 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_halt(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_umount(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_ftruncate(void);
+extern uint64 sys_lseek(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -144,6 +153,15 @@ static uint64 (*syscalls[])(void) = {
     [SYS_mkdir]   sys_mkdir,
     [SYS_close]   sys_close,
     [SYS_halt]    sys_halt,
+    [SYS_sched_setaffinity] sys_sched_setaffinity,
+    [SYS_sched_getaffinity] sys_sched_getaffinity,
+    [SYS_mount]   sys_mount,
+    [SYS_umount]  sys_umount,
+    [SYS_sync]    sys_sync,
+    [SYS_fsync]   sys_fsync,
+    [SYS_fallocate] sys_fallocate,
+    [SYS_ftruncate] sys_ftruncate,
+    [SYS_lseek]   sys_lseek,
 };
 
 void syscall(void)
@@ -20,4 +20,13 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
-#define SYS_halt   22
\ No newline at end of file
+#define SYS_halt   22
+#define SYS_sched_setaffinity 23
+#define SYS_sched_getaffinity 24
+#define SYS_mount  25
+#define SYS_umount 26
+#define SYS_sync   27
+#define SYS_fsync  28
+#define SYS_fallocate 29
+#define SYS_ftruncate 30
+#define SYS_lseek  31
\ No newline at end of file
@@ -123,7 +123,7 @@ sys_fstat(void)
 uint64
 sys_link(void)
 {
-  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
+  char name[DIRSIZ+1], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
@@ -173,34 +173,61 @@ bad:
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
+  uint off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  // every entry has room for two bytes of name.
+  for(off=0; off<dp->size; off+=de.reclen){
+    if(readi(dp, 0, (uint64)&de, off, DIRHDR+2) < DIRHDR || de.reclen < DIRHDR)
       panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
+    if(de.inum == 0)
+      continue;
+    if(de.namelen == 1 && de.name[0] == '.')
+      continue;
+    if(de.namelen == 2 && de.name[0] == '.' && de.name[1] == '.')
+      continue;
+    return 0;
   }
   return 1;
 }
 
+// Look up the directory that holds the last element of path,
+// as nameiparent() does, inside a transaction that is left
+// open only if that directory's file system has a log: sets
+// *logged to whether the caller must end_op(). tmpfs changes
+// then take no log space. The lookup itself needs the
+// transaction, in case it drops the last reference to a disk
+// inode on the way.
+static struct inode*
+nameiparentop(char *path, char *name, int *logged)
+{
+  struct inode *dp;
+
+  *logged = 0;
+  begin_op();
+  if((dp = nameiparent(path, name)) == 0){
+    end_op();
+    return 0;
+  }
+  if((*logged = dp->ops->logged) == 0)
+    end_op();
+  return dp;
+}
+
 uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], path[MAXPATH];
+  ushort inum;
+  char name[DIRSIZ+1], path[MAXPATH];
   uint off;
+  int logged;
 
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
-  if((dp = nameiparent(path, name)) == 0){
-    end_op();
+  if((dp = nameiparentop(path, name, &logged)) == 0)
     return -1;
-  }
 
   ilock(dp);
 
@@ -218,37 +245,56 @@ sys_unlink(void)
     iunlockput(ip);
     goto bad;
   }
+  // a covered directory looks empty, but umount needs
+  // a path to it.
+  if(fsmounted(ip)){
+    iunlockput(ip);
+    goto bad;
+  }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  // leave the entry in place, unused; dirlink() reuses it.
+  inum = 0;
+  if(writei(dp, 0, (uint64)&inum, off, sizeof(inum)) != sizeof(inum))
     panic("unlink: writei");
+  dcacheremove(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
   }
   iunlockput(dp);
 
+  if(ip->type == T_DIR){
+    // an empty directory: only these can be cached.
+    dcacheremove(ip, ".");
+    dcacheremove(ip, "..");
+  }
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
 
-  end_op();
+  if(logged)
+    end_op();
 
   return 0;
 
 bad:
   iunlockput(dp);
-  end_op();
+  if(logged)
+    end_op();
   return -1;
 }
 
+// Create path as a new inode of the given type, or for
+// T_FILE open it if it exists; returns it locked. Like
+// nameiparentop(), sets *logged to whether the caller must
+// end_op(), whether or not it succeeds.
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(char *path, short type, short major, short minor, int *logged)
 {
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
 
-  if((dp = nameiparent(path, name)) == 0)
+  if((dp = nameiparentop(path, name, logged)) == 0)
     return 0;
 
   ilock(dp);
@@ -262,7 +308,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -308,36 +354,43 @@ sys_open(void)
   int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
+  int n, logged;
 
   argint(1, &omode);
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
-
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, T_FILE, 0, 0, &logged);
     if(ip == 0){
-      end_op();
+      if(logged)
+        end_op();
       return -1;
     }
   } else {
+    begin_op();
     if((ip = namei(path)) == 0){
       end_op();
       return -1;
     }
-    ilock(ip);
+    if((logged = ip->ops->logged) == 0)
+      end_op();
+    if(omode & O_TRUNC)
+      ilock(ip);
+    else
+      ilockshared(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      if(logged)
+        end_op();
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op();
+    if(logged)
+      end_op();
     return -1;
   }
 
@@ -345,7 +398,8 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    if(logged)
+      end_op();
     return -1;
   }
 
@@ -361,11 +415,12 @@ sys_open(void)
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
+    itrunc(ip, 0);
   }
 
   iunlock(ip);
-  end_op();
+  if(logged)
+    end_op();
 
   return fd;
 }
@@ -375,14 +430,18 @@ sys_mkdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
+  int logged;
 
-  begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if((ip = create(path, T_DIR, 0, 0, &logged)) == 0){
+    if(logged)
+      end_op();
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  if(logged)
+    end_op();
   return 0;
 }
 
@@ -391,18 +450,20 @@ sys_mknod(void)
 {
   struct inode *ip;
   char path[MAXPATH];
-  int major, minor;
+  int major, minor, logged;
 
-  begin_op();
   argint(1, &major);
   argint(2, &minor);
-  if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
-    end_op();
+  if((argstr(0, path, MAXPATH)) < 0)
+    return -1;
+  if((ip = create(path, T_DEVICE, major, minor, &logged)) == 0){
+    if(logged)
+      end_op();
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  if(logged)
+    end_op();
   return 0;
 }
 
@@ -418,7 +479,7 @@ sys_chdir(void)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
     end_op();
@@ -503,3 +564,173 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Device number of a disk named "disk<n>", or 0.
+static uint
+diskdev(char *name)
+{
+  uint dev = 0;
+
+  if(strncmp(name, "disk", 4) != 0 || name[4] == 0)
+    return 0;
+  for(name += 4; *name; name++){
+    if(*name < '0' || *name > '9' || dev > NDISK)
+      return 0;
+    dev = dev*10 + *name - '0';
+  }
+  return dev;
+}
+
+// Free the resources of file system dev, which is no
+// longer mounted. Outside a transaction.
+static void
+releasefs(uint dev)
+{
+  if(dev >= TMPDEV)
+    tmpfsdrop(dev);
+  else
+    fsdetach(dev);
+}
+
+// Mount a file system on directory target. source is
+// "tmpfs" for a new, empty tmpfs, or "disk<n>" for the
+// file system on disk device n.
+uint64
+sys_mount(void)
+{
+  char source[MAXPATH], target[MAXPATH];
+  struct inode *dp, *root;
+  uint dev;
+
+  if(argstr(0, source, MAXPATH) < 0 || argstr(1, target, MAXPATH) < 0)
+    return -1;
+
+  // set up the file system first, outside the transaction,
+  // since attaching a disk replays its log.
+  if(strncmp(source, "tmpfs", MAXPATH) == 0){
+    if((root = tmpfsmake()) == 0)
+      return -1;
+    iunlock(root);
+  } else if((dev = diskdev(source)) != 0){
+    if((root = fsattach(dev)) == 0)
+      return -1;
+  } else {
+    return -1;
+  }
+  dev = root->dev;
+
+  begin_op();
+  if((dp = namei(target)) == 0)
+    goto bad;
+  // keep dp locked while mounting, so that unlink()
+  // sees the mount, or dp is gone before we look.
+  ilockshared(dp);
+  if(dp->type != T_DIR || dp->nlink < 1){
+    iunlockput(dp);
+    goto bad;
+  }
+  if(fsmount(dp, root) < 0){
+    iunlockput(dp);
+    goto bad;
+  }
+  iunlock(dp);
+  end_op();
+  return 0;
+
+ bad:
+  iput(root);
+  end_op();
+  releasefs(dev);
+  return -1;
+}
+
+// Unmount the file system mounted on target.
+// Fails if any of its files are open or in use as a
+// current directory.
+uint64
+sys_umount(void)
+{
+  char target[MAXPATH];
+  struct inode *ip;
+  int dev;
+
+  if(argstr(0, target, MAXPATH) < 0)
+    return -1;
+
+  begin_op();
+  if((ip = namei(target)) == 0){
+    end_op();
+    return -1;
+  }
+  dev = fsunmount(ip);
+  end_op();
+  if(dev < 0)
+    return -1;
+  releasefs(dev);
+  return 0;
+}
+
+// Commit all finished file system updates and write every
+// committed block back to its home location.
+uint64
+sys_sync(void)
+{
+  log_sync(1);
+  return 0;
+}
+
+// Make the updates to fd's file durable. They are in the
+// log once committed; writing them home can wait. Files on
+// tmpfs have nothing to make durable.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE && f->ip->ops->logged)
+    log_sync(0);
+  return 0;
+}
+
+// Reserve storage for len bytes at off in the file,
+// without writing it or changing the file's size.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len < 0)
+    return -1;
+  return fileallocate(f, off, len);
+}
+
+// Set the size of the file to len bytes.
+uint64
+sys_ftruncate(void)
+{
+  struct file *f;
+  int len;
+
+  argint(1, &len);
+  if(argfd(0, 0, &f) < 0 || len < 0)
+    return -1;
+  return filetruncate(f, len);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
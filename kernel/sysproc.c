@@ -96,4 +96,29 @@ uint64 sys_halt(void)
 {
   // To-DO: Implement the halt system call
   return 0;
-}
\ No newline at end of file
+}
+
+// pin a process to a set of harts.
+// sched_setaffinity(pid, mask): pid 0 is the caller,
+// bit i of mask allows hart i.
+uint64 sys_sched_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+// read back a process's affinity mask.
+// sched_getaffinity(pid, &mask): pid 0 is the caller.
+uint64 sys_sched_getaffinity(void)
+{
+  int pid;
+  uint64 addr;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  return getaffinity(pid, addr);
+}
@@ -0,0 +1,119 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+//
+// TLB shootdown.
+//
+// code that changes or removes PTEs in a user page table
+// calls tlb_shootdown() afterwards, once per batch of pages.
+// every other hart that is running that page table gets an
+// IPI and invalidates the range before tlb_shootdown()
+// returns. harts running some other page table are skipped:
+// userret and uservec in trampoline.S flush the whole TLB
+// whenever they load satp, so a hart that switches to the
+// page table later cannot see the old PTEs.
+//
+
+// ranges longer than this are flushed with one full sfence.vma.
+#define TLBFULL 32
+
+static struct {
+  int busy;        // a shootdown is in progress.
+  uint64 va;       // the range it is invalidating.
+  uint64 npages;
+} tlb;
+
+static void
+flushrange(uint64 va, uint64 npages)
+{
+  if(npages > TLBFULL){
+    sfence_vma();
+    return;
+  }
+  for(uint64 i = 0; i < npages; i++)
+    sfence_vma_page(va + i*PGSIZE);
+}
+
+// carry out a shootdown request aimed at this hart, if any.
+// called with interrupts off, from the IPI handler and from
+// loops that spin with interrupts off, since the initiator
+// may be waiting for this hart to answer.
+void
+tlb_poll(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->tlbpending == 0)
+    return;
+  flushrange(tlb.va, tlb.npages);
+  __sync_synchronize();
+  c->tlbpending = 0;
+}
+
+// invalidate npages starting at va in pagetable on every
+// hart that is running it. the caller must already have
+// updated the PTEs.
+void
+tlb_shootdown(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct cpu *c;
+  uint64 start, targets = 0;
+  int me;
+
+  if(npages == 0)
+    return;
+
+  push_off();
+  c = mycpu();
+  me = cpuid();
+  start = r_time();
+
+  // one shootdown at a time. keep answering requests while
+  // waiting: the current initiator may be waiting for us.
+  while(__sync_lock_test_and_set(&tlb.busy, 1) != 0)
+    tlb_poll();
+
+  // make the caller's PTE stores visible before looking at
+  // which harts run the page table. a hart that starts to
+  // run it after this point sees the new PTEs.
+  __sync_synchronize();
+
+  tlb.va = va;
+  tlb.npages = npages;
+  for(int id = 0; id < NCPU; id++){
+    if(id == me || (cpuonline & CPUBIT(id)) == 0)
+      continue;
+    if(cpus[id].pagetable != pagetable)
+      continue;
+    cpus[id].tlbpending = 1;
+    targets |= CPUBIT(id);
+  }
+  __sync_synchronize();
+
+  for(int id = 0; id < NCPU; id++){
+    if(targets & CPUBIT(id)){
+      ipi_send(id);
+      c->ntlbipi++;
+    }
+  }
+  for(int id = 0; id < NCPU; id++){
+    if(targets & CPUBIT(id)){
+      while(cpus[id].tlbpending)
+        ;
+    }
+  }
+
+  __sync_lock_release(&tlb.busy);
+
+  // this hart is in the kernel, on the kernel page table, so it
+  // holds no entries for pagetable; see the comment at the top.
+
+  c->ntlbshoot++;
+  c->tlbtime += r_time() - start;
+  pop_off();
+}
@@ -0,0 +1,293 @@
+//
+// tmpfs: a file system that keeps its files in memory.
+//
+// each mount of tmpfs is a separate file system with its own
+// device number, TMPDEV and up. inode contents live in kalloc()
+// pages, found through a per-inode index page of page pointers,
+// so reads and writes never touch the buffer cache, the log, or
+// the disk, and everything is lost at reboot.
+//
+// the node table below plays the role of the on-disk inode
+// blocks: fs.c caches nodes in the inode table like disk inodes,
+// and calls the functions here through tmpops. a node's
+// contents are protected by the sleep-lock of its in-memory
+// inode; tmpfs.lock protects allocation of nodes.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// pages per file: one index page of page pointers.
+#define TMPNPAGE (PGSIZE / sizeof(char*))
+
+// what a page missing from a file reads as.
+static char zeropage[PGSIZE];
+
+struct tmpnode {
+  uint dev;
+  short type;         // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **index;       // TMPNPAGE data page pointers, or 0
+};
+
+struct {
+  struct spinlock lock;
+  uint nextdev;       // device number of the next mount
+  struct tmpnode node[NTMPINODE];
+} tmpfs;
+
+void
+tmpfsinit(void)
+{
+  initlock(&tmpfs.lock, "tmpfs");
+  tmpfs.nextdev = TMPDEV;
+}
+
+// inode numbers are node table indexes plus one,
+// unique across all tmpfs mounts.
+static struct tmpnode*
+tnode(struct inode *ip)
+{
+  if(ip->inum < 1 || ip->inum > NTMPINODE)
+    panic("tnode");
+  return &tmpfs.node[ip->inum - 1];
+}
+
+static uint
+tmpialloc(uint dev, short type, uint near)
+{
+  struct tmpnode *t;
+
+  acquire(&tmpfs.lock);
+  for(t = tmpfs.node; t < &tmpfs.node[NTMPINODE]; t++){
+    if(t->type == 0){
+      memset(t, 0, sizeof(*t));
+      t->dev = dev;
+      t->type = type;
+      release(&tmpfs.lock);
+      return t - tmpfs.node + 1;
+    }
+  }
+  release(&tmpfs.lock);
+  printf("tmpialloc: no inodes\n");
+  return 0;
+}
+
+static void
+tmpiread(struct inode *ip)
+{
+  struct tmpnode *t = tnode(ip);
+
+  ip->type = t->type;
+  ip->major = t->major;
+  ip->minor = t->minor;
+  ip->nlink = t->nlink;
+  ip->size = t->size;
+}
+
+static void
+tmpiupdate(struct inode *ip)
+{
+  struct tmpnode *t = tnode(ip);
+
+  t->major = ip->major;
+  t->minor = ip->minor;
+  t->nlink = ip->nlink;
+  t->size = ip->size;
+  acquire(&tmpfs.lock);
+  t->type = ip->type;   // 0 frees the node
+  release(&tmpfs.lock);
+}
+
+// Free the data pages of t.
+static void
+freepages(struct tmpnode *t)
+{
+  if(t->index == 0)
+    return;
+  for(int i = 0; i < TMPNPAGE; i++){
+    if(t->index[i])
+      kfree(t->index[i]);
+  }
+  kfree((char*)t->index);
+  t->index = 0;
+}
+
+static int
+tmpitrunc(struct inode *ip, uint size)
+{
+  struct tmpnode *t = tnode(ip);
+  uint keep = (size + PGSIZE - 1) / PGSIZE;  // pages still in use
+
+  // when growing, the new part of the file is a hole, or
+  // preallocated pages, which are zero: nothing to do.
+  if(size == 0){
+    freepages(t);
+  } else if(size < ip->size && t->index){
+    if(size % PGSIZE && t->index[size / PGSIZE])
+      memset(t->index[size / PGSIZE] + size % PGSIZE, 0, PGSIZE - size % PGSIZE);
+    for(uint i = keep; i < TMPNPAGE; i++){
+      if(t->index[i]){
+        kfree(t->index[i]);
+        t->index[i] = 0;
+      }
+    }
+  }
+  ip->size = size;
+  tmpiupdate(ip);
+  return 0;
+}
+
+// Return the page holding byte off of ip, allocating
+// it if alloc is set. Returns 0 if there is none.
+static char*
+tmppage(struct inode *ip, uint off, int alloc)
+{
+  struct tmpnode *t = tnode(ip);
+  uint pn = off / PGSIZE;
+  char *pg;
+
+  if(pn >= TMPNPAGE)
+    return 0;
+  if(t->index == 0){
+    if(!alloc || (t->index = (char**)kalloc()) == 0)
+      return 0;
+    memset(t->index, 0, PGSIZE);
+  }
+  if((pg = t->index[pn]) == 0 && alloc){
+    if((pg = kalloc()) == 0)
+      return 0;
+    memset(pg, 0, PGSIZE);
+    t->index[pn] = pg;
+  }
+  return pg;
+}
+
+static int
+tmpfallocate(struct inode *ip, uint off, uint n)
+{
+  uint end = off + n;
+
+  if(end > TMPNPAGE*PGSIZE)
+    return -1;
+  for(off = off - off % PGSIZE; off < end; off += PGSIZE){
+    if(tmppage(ip, off, 1) == 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int
+tmpreadi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  char *pg;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pg = tmppage(ip, off, 0)) == 0)
+      pg = zeropage;  // a hole
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyout(user_dst, dst, pg + (off % PGSIZE), m) == -1)
+      return -1;
+  }
+  return tot;
+}
+
+static int
+tmpwritei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  char *pg;
+
+  if(off + n < off)
+    return -1;
+  if(off + n > TMPNPAGE*PGSIZE)
+    return -1;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    if((pg = tmppage(ip, off, 1)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyin(pg + (off % PGSIZE), user_src, src, m) == -1)
+      break;
+  }
+
+  if(tot > 0 && off > ip->size)
+    ip->size = off;
+  tmpiupdate(ip);
+
+  return tot;
+}
+
+struct inodeops tmpops = {
+  .ialloc = tmpialloc,
+  .iread = tmpiread,
+  .iupdate = tmpiupdate,
+  .itrunc = tmpitrunc,
+  .fallocate = tmpfallocate,
+  .readi = tmpreadi,
+  .writei = tmpwritei,
+  .logged = 0,
+};
+
+// Free every node of the tmpfs on device dev,
+// which is no longer mounted.
+void
+tmpfsdrop(uint dev)
+{
+  struct tmpnode *t;
+
+  for(t = tmpfs.node; t < &tmpfs.node[NTMPINODE]; t++){
+    if(t->type == 0 || t->dev != dev)
+      continue;
+    freepages(t);
+    acquire(&tmpfs.lock);
+    t->type = 0;
+    release(&tmpfs.lock);
+  }
+}
+
+// Make a new, empty tmpfs and return its locked root
+// directory, or 0 if out of memory.
+struct inode*
+tmpfsmake(void)
+{
+  struct inode *root;
+  uint dev;
+
+  acquire(&tmpfs.lock);
+  dev = tmpfs.nextdev++;
+  release(&tmpfs.lock);
+
+  if((root = ialloc(dev, T_DIR, 0)) == 0)
+    return 0;
+  ilock(root);
+  root->nlink = 1;
+  iupdate(root);
+  // ".." of a root names the root itself; namex()
+  // follows it out of the mount instead.
+  if(dirlink(root, ".", root->inum) < 0 || dirlink(root, "..", root->inum) < 0){
+    root->nlink = 0;
+    iupdate(root);
+    iunlockput(root);
+    return 0;
+  }
+  return root;
+}
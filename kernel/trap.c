@@ -194,8 +194,8 @@ devintr()
 
     if(irq == UART0_IRQ){
       uartintr();
-    } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+    } else if(irq >= VIRTIO_IRQ(0) && irq < VIRTIO_IRQ(NDISK)){
+      virtio_disk_intr(irq - VIRTIO_IRQ(0));
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -211,6 +211,10 @@ devintr()
     // timer interrupt.
     clockintr();
     return 2;
+  } else if(scause == 0x8000000000000001L){
+    // supervisor software interrupt, an IPI from another hart.
+    ipi_intr();
+    return 1;
   } else {
     return 0;
   }
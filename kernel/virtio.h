@@ -29,6 +29,7 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -38,16 +39,20 @@
 
 // device feature bits
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
+#define VIRTIO_BLK_F_FLUSH           9	/* Has a write cache, and VIRTIO_BLK_T_FLUSH */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
+#define VIRTIO_BLK_F_DISCARD        13	/* supports VIRTIO_BLK_T_DISCARD */
+#define VIRTIO_BLK_F_WRITE_ZEROES   14	/* supports VIRTIO_BLK_T_WRITE_ZEROES */
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// a request takes three, so NUM/3 can be in flight.
+#define NUM 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -64,7 +69,7 @@ struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt once used idx passes this
 };
 
 // one entry in the "used" ring, with which the
@@ -78,13 +83,28 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify once avail idx passes this
 };
 
+// with EVENT_IDX, must the other side hear that its index moved
+// from old to new, given that it asked to hear when it passed
+// event? from the spec, section 2.6.7.2.
+#define VRING_NEED_EVENT(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
+// offsets of fields in the block device's configuration.
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES 34       // uint16, with VIRTIO_BLK_F_MQ
+#define VIRTIO_BLK_CONFIG_MAX_DISCARD 36      // uint32 sectors, with ..._F_DISCARD
+#define VIRTIO_BLK_CONFIG_MAX_WRITE_ZEROES 48 // uint32 sectors, with ..._F_WRITE_ZEROES
+
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_FLUSH 4         // make completed writes durable
+#define VIRTIO_BLK_T_DISCARD 11      // forget a range of sectors
+#define VIRTIO_BLK_T_WRITE_ZEROES 13 // zero a range of sectors
 
 // the format of the first descriptor in a disk request.
 // to be followed by two more descriptors containing
@@ -94,3 +114,11 @@ struct virtio_blk_req {
   uint32 reserved;
   uint64 sector;
 };
+
+// for VIRTIO_BLK_T_DISCARD and ..._WRITE_ZEROES, the second
+// descriptor holds this instead of a block.
+struct virtio_blk_range {
+  uint64 sector;
+  uint32 num_sectors;
+  uint32 flags;
+};
@@ -1,9 +1,31 @@
 //
-// driver for qemu's virtio disk device.
+// driver for qemu's virtio disk devices.
 // uses qemu's mmio interface to virtio.
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// qemu's virt machine has NDISK virtio mmio slots. the disk in
+// slot n is device number n+1, so the root disk (ROOTDEV) sits
+// in slot 0. each disk has one or more queues, each with its
+// own lock; see myqueue().
+//
+// with VIRTIO_RING_F_EVENT_IDX, the driver and device tell each
+// other how far along their rings they have got, so that the
+// driver notifies only a device that has gone idle, and the
+// device interrupts only once for a burst of completions that
+// the driver is not yet looking at.
+//
+// requests are asynchronous: virtio_disk_submit() queues one
+// and returns, and when the device is done, the completion
+// calls the buf's iodone function. virtio_disk_rw() queues one
+// and waits for it; the completion wakes it.
+//
+// a request normally sleeps until the completion interrupt.
+// a polled request (bwritepoll(), for the log header) first spins
+// on the used ring for up to DISKPOLL microseconds, and so
+// skips the wakeup and scheduler round trip when the device
+// is quick.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -16,10 +38,12 @@
 #include "buf.h"
 #include "virtio.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
-static struct disk {
+// one virtqueue of a disk. each has its own lock, so that
+// harts submitting to different queues don't contend.
+struct queue {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -41,124 +65,203 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int inflight;    // requests given to the device, not yet done
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
     struct buf *b;
+    int *done;     // for a range request, which has no buf
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+  struct virtio_blk_range range[NUM];
   
-  struct spinlock vdisk_lock;
-  
-} disk;
+  struct spinlock lock;
+
+  // see virtio_disk_stat().
+  uint64 nio;       // requests
+  uint64 nnotify;   // QUEUE_NOTIFY writes
+  uint64 npolled;   // completions noticed by a polling requester
+  uint64 nintr;     // completions noticed by the interrupt handler
+  uint64 nspun;     // polled requests that gave up and slept
+  uint64 nflush;    // cache flushes
+};
+
+struct disk {
+  uint64 base;     // mmio registers, or 0 if no disk in this slot.
+  int eventidx;    // negotiated VIRTIO_RING_F_EVENT_IDX?
+  int nq;          // queues in use; hart i submits to q[i % nq].
+  int flush;       // negotiated VIRTIO_BLK_F_FLUSH: writes are cached
+  uint maxdiscard; // sectors per discard, or 0 if it can't
+  uint maxzero;    // sectors per write-zeroes, or 0 if it can't
+  uint64 nirq;     // interrupts taken
+  struct queue q[NDISKQ];
+};
+
+static struct disk disks[NDISK];
+
+// the disk for device number dev, or 0 if there is none.
+static struct disk*
+getdisk(uint dev)
+{
+  if(dev < 1 || dev > NDISK || disks[dev-1].base == 0)
+    return 0;
+  return &disks[dev-1];
+}
 
+// is there a disk with device number dev?
+int
+virtio_disk_present(uint dev)
+{
+  return getdisk(dev) != 0;
+}
+
+static void disk_init(struct disk *d, uint64 base);
+static void queue_init(struct disk *d, int n);
+
+// find and set up the disks in all the slots.
 void
 virtio_disk_init(void)
+{
+  for(int i = 0; i < NDISK; i++){
+    uint64 base = VIRTIO(i);
+    if(*(uint32*)(base + VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+       *(uint32*)(base + VIRTIO_MMIO_VERSION) != 2 ||
+       *(uint32*)(base + VIRTIO_MMIO_DEVICE_ID) != 2 ||
+       *(uint32*)(base + VIRTIO_MMIO_VENDOR_ID) != 0x554d4551)
+      continue;  // empty slot, or not a block device
+    disk_init(&disks[i], base);
+  }
+}
+
+static void
+disk_init(struct disk *d, uint64 base)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->base = base;
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
-  }
-  
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 config = d->base + VIRTIO_MMIO_CONFIG;
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  d->eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  d->flush = (features & (1 << VIRTIO_BLK_F_FLUSH)) != 0;
+
+  // with VIRTIO_BLK_F_MQ (qemu's num-queues=n), use a queue
+  // per hart, up to NDISKQ of them.
+  d->nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    d->nq = *(volatile uint16 *)(config + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+    if(d->nq > NDISKQ)
+      d->nq = NDISKQ;
+    if(d->nq < 1)
+      d->nq = 1;
+  }
+
+  // see virtio_disk_discard() and virtio_disk_zero().
+  if(features & (1 << VIRTIO_BLK_F_DISCARD))
+    d->maxdiscard = *(volatile uint32 *)(config + VIRTIO_BLK_CONFIG_MAX_DISCARD);
+  if(features & (1 << VIRTIO_BLK_F_WRITE_ZEROES))
+    d->maxzero = *(volatile uint32 *)(config + VIRTIO_BLK_CONFIG_MAX_WRITE_ZEROES);
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  for(int i = 0; i < d->nq; i++)
+    queue_init(d, i);
+
+  // tell device we're completely ready.
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
+
+  // plic.c and trap.c arrange for interrupts from VIRTIO_IRQ(n).
+}
+
+// set up virtqueue n of disk d.
+static void
+queue_init(struct disk *d, int n)
+{
+  struct queue *q = &d->q[n];
+
+  initlock(&q->lock, "virtio_disk");
 
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = n;
+
+  // ensure the queue is not in use.
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
   // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
-    panic("virtio disk has no queue 0");
+    panic("virtio disk has no queue");
   if(max < NUM)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
 
   // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
 
   // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
-
-  // tell device we're completely ready.
-  status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
-
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+    q->free[i] = 1;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct queue *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +270,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct queue *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct queue *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -199,25 +302,75 @@ free_chain(int i)
 // allocate three descriptors (they need not be contiguous).
 // disk transfers always use three descriptors.
 static int
-alloc3_desc(int *idx)
+alloc3_desc(struct queue *q, int *idx)
 {
   for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// hand the finished requests in the used ring back to their
+// requesters, and count them in *n. the caller holds q->lock.
+static void
+disk_complete(struct disk *d, struct queue *q, uint64 *n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  for(;;){
+    // the device increments q->used->idx when it
+    // adds an entry to the used ring.
+
+    while(q->used_idx != *(volatile uint16 *)&q->used->idx){
+      __sync_synchronize();
+      int id = q->used->ring[q->used_idx % NUM].id;
+
+      if(q->info[id].status != 0)
+        panic("virtio_disk_intr status");
+
+      struct buf *b = q->info[id].b;
+      int *done = q->info[id].done;
+      q->info[id].b = 0;
+      q->info[id].done = 0;
+      free_chain(q, id);
+      if(b == 0){
+        *done = 1;   // a command from disk_cmd()
+        wakeup(done);
+      } else {
+        b->disk = 0;   // disk is done with buf
+        if(b->iodone)
+          b->iodone(b);
+        else
+          wakeup(b);
+      }
+
+      q->used_idx += 1;
+      q->inflight -= 1;
+      (*n)++;
+    }
+    if(!d->eventidx)
+      return;
 
-  acquire(&disk.vdisk_lock);
+    // ask for an interrupt at the next completion, then look
+    // again, in case it came before the device saw the request.
+    q->avail->used_event = q->used_idx;
+    __sync_synchronize();
+    if(q->used_idx == *(volatile uint16 *)&q->used->idx)
+      return;
+  }
+}
+
+static void queue_push(struct disk *d, struct queue *q, int head, int poll);
+
+// give the device a request to read or write b.
+// the caller holds q->lock.
+static void
+disk_start(struct disk *d, struct queue *q, struct buf *b, int write, int poll)
+{
+  uint64 sector = b->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -226,16 +379,16 @@ virtio_disk_rw(struct buf *b, int write)
   // allocate the three descriptors.
   int idx[3];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc3_desc(q, idx) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    sleep(&q->free[0], &q->lock);
   }
 
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,57 +397,254 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  q->desc[idx[1]].addr = (uint64) b->data;
+  q->desc[idx[1]].len = BSIZE;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    q->desc[idx[1]].flags = 0; // device reads b->data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    q->desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+  q->desc[idx[1]].flags |= VRING_DESC_F_NEXT;
+  q->desc[idx[1]].next = idx[2];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->desc[idx[2]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[2]].len = 1;
+  q->desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
+  // record struct buf for disk_complete().
   b->disk = 1;
-  disk.info[idx[0]].b = b;
+  q->info[idx[0]].b = b;
+
+  queue_push(d, q, idx[0], poll);
+}
 
+// give the device the chain of descriptors starting at head.
+// the caller holds q->lock.
+static void
+queue_push(struct disk *d, struct queue *q, int head, int poll)
+{
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = head;
 
   __sync_synchronize();
 
+  // a polled request that is the only one in flight
+  // doesn't want an interrupt, if the device will hold it.
+  q->inflight += 1;
+  q->nio++;
+  if(poll && d->eventidx && q->inflight == 1)
+    q->avail->used_event = q->used_idx + NUM;
+
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  q->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  // with EVENT_IDX, a device still busy with earlier
+  // requests will find this one without a notify.
+  if(!d->eventidx ||
+     VRING_NEED_EVENT(*(volatile uint16 *)&q->used->avail_event,
+                      q->avail->idx, (uint16)(q->avail->idx - 1))){
+    *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = q - d->q; // value is queue number
+    q->nnotify++;
+  }
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// the queue for this hart to submit to. a process may move
+// to another hart, but any queue works; this just spreads
+// the harts out.
+static struct queue*
+myqueue(struct disk *d)
+{
+  return &d->q[cpuid() % d->nq];
+}
+
+// start reading or writing b, and return without waiting.
+// b->iodone is called when the transfer is done, from the
+// disk interrupt with the queue's lock held, so it must not
+// sleep. b must stay locked until then.
+void
+virtio_disk_submit(struct buf *b, int write)
+{
+  struct disk *d = getdisk(b->dev);
+  struct queue *q;
+
+  if(d == 0)
+    panic("virtio_disk_submit: no disk");
+
+  q = myqueue(d);
+  acquire(&q->lock);
+  disk_start(d, q, b, write, 0);
+  release(&q->lock);
+}
+
+// read or write b, and wait for it. if poll, spin for a
+// while before sleeping; see the comment at the top.
+void
+virtio_disk_rw(struct buf *b, int write, int poll)
+{
+  struct disk *d = getdisk(b->dev);
+  struct queue *q;
+
+  if(d == 0)
+    panic("virtio_disk_rw: no disk");
+
+  q = myqueue(d);
+  acquire(&q->lock);
+  disk_start(d, q, b, write, poll);
+
+  if(poll){
+    // r_time() counts at 10 MHz on qemu's virt machine.
+    uint64 end = r_time() + DISKPOLL * 10;
+    while(b->disk && r_time() < end){
+      if(q->used_idx != *(volatile uint16 *)&q->used->idx)
+        disk_complete(d, q, &q->npolled);
+    }
+    if(b->disk){
+      q->nspun++;
+      // turn the interrupt back on before sleeping.
+      disk_complete(d, q, &q->npolled);
+    }
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  // Wait for disk_complete() to say request has finished.
+  while(b->disk) {
+    sleep(b, &q->lock);
+  }
 
-  release(&disk.vdisk_lock);
+  release(&q->lock);
+}
+
+// send disk d a command of type that moves no block: with r,
+// a range request (VIRTIO_BLK_T_DISCARD or ..._WRITE_ZEROES)
+// described by r; without, a flush. waits for it.
+// the caller holds q->lock.
+static void
+disk_cmd(struct disk *d, struct queue *q, int type, struct virtio_blk_range *r)
+{
+  int idx[3], n, done;
+
+  while(alloc3_desc(q, idx) != 0)
+    sleep(&q->free[0], &q->lock);
+
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
+  buf0->type = type;
+  buf0->reserved = 0;
+  buf0->sector = 0;
+
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  n = 1;
+
+  if(r){
+    q->range[idx[0]] = *r;
+    q->desc[idx[0]].next = idx[1];
+    q->desc[idx[1]].addr = (uint64) &q->range[idx[0]];
+    q->desc[idx[1]].len = sizeof(struct virtio_blk_range);
+    q->desc[idx[1]].flags = VRING_DESC_F_NEXT; // device reads the range
+    n = 2;
+  } else {
+    free_desc(q, idx[2]);   // a flush takes only two
+    idx[2] = idx[1];
+  }
+
+  q->info[idx[0]].status = 0xff;
+  q->desc[idx[n-1]].next = idx[2];
+  q->desc[idx[2]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[2]].len = 1;
+  q->desc[idx[2]].flags = VRING_DESC_F_WRITE;
+  q->desc[idx[2]].next = 0;
+
+  done = 0;
+  q->info[idx[0]].b = 0;
+  q->info[idx[0]].done = &done;
+  queue_push(d, q, idx[0], 0);
+  while(!done)
+    sleep(&done, &q->lock);
+}
+
+// ask disk d to apply command type (VIRTIO_BLK_T_DISCARD or
+// ..._WRITE_ZEROES) to blocks [blockno, blockno+n), at most max
+// sectors per request, and wait for it.
+static void
+disk_range(struct disk *d, int type, uint max, uint blockno, uint n)
+{
+  uint64 sector = (uint64)blockno * (BSIZE / 512);
+  uint64 nsect = (uint64)n * (BSIZE / 512);
+  struct queue *q = myqueue(d);
+  struct virtio_blk_range r;
+
+  acquire(&q->lock);
+  for(; nsect > 0; sector += r.num_sectors, nsect -= r.num_sectors){
+    r.sector = sector;
+    r.num_sectors = nsect < max ? nsect : max;
+    r.flags = 0;
+    disk_cmd(d, q, type, &r);
+  }
+  release(&q->lock);
 }
 
+// make the writes to disk dev that have completed durable,
+// if the disk has a write cache; without one they already are.
 void
-virtio_disk_intr()
+virtio_disk_flush(uint dev)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = getdisk(dev);
+  struct queue *q;
+
+  if(d == 0 || !d->flush)
+    return;
+  q = myqueue(d);
+  acquire(&q->lock);
+  disk_cmd(d, q, VIRTIO_BLK_T_FLUSH, 0);
+  q->nflush++;
+  release(&q->lock);
+}
+
+// tell disk dev that blocks [blockno, blockno+n) hold nothing
+// worth keeping. returns -1 if the disk can't be told.
+int
+virtio_disk_discard(uint dev, uint blockno, uint n)
+{
+  struct disk *d = getdisk(dev);
+
+  if(d == 0 || d->maxdiscard == 0)
+    return -1;
+  disk_range(d, VIRTIO_BLK_T_DISCARD, d->maxdiscard, blockno, n);
+  return 0;
+}
+
+// have disk dev zero blocks [blockno, blockno+n) without
+// sending it the zeros. returns -1 if it can't.
+int
+virtio_disk_zero(uint dev, uint blockno, uint n)
+{
+  struct disk *d = getdisk(dev);
+
+  if(d == 0 || d->maxzero == 0)
+    return -1;
+  disk_range(d, VIRTIO_BLK_T_WRITE_ZEROES, d->maxzero, blockno, n);
+  return 0;
+}
+
+// interrupt from the disk in virtio mmio slot n.
+void
+virtio_disk_intr(int n)
+{
+  struct disk *d;
+
+  if(n < 0 || n >= NDISK || disks[n].base == 0)
+    return;
+  d = &disks[n];
+
+  d->nirq++;
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
@@ -302,26 +652,40 @@ virtio_disk_intr()
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
+  // the interrupt is for the whole device: look at every
+  // queue. a polling requester may have taken the
+  // completions already, leaving nothing to do here.
+  for(int i = 0; i < d->nq; i++){
+    struct queue *q = &d->q[i];
+    acquire(&q->lock);
+    disk_complete(d, q, &q->nintr);
+    release(&q->lock);
   }
+}
 
-  release(&disk.vdisk_lock);
+// print how each disk queue's completions were noticed.
+// runs when user types ^V on console.
+// no lock, like procdump().
+void
+virtio_disk_stat(void)
+{
+  printf("\ndisk  queue  event idx  requests  notifies  interrupts"
+         "  polled  interrupt  polls that slept  flushes\n");
+  for(int i = 0; i < NDISK; i++){
+    struct disk *d = &disks[i];
+    if(d->base == 0)
+      continue;
+    // interrupts are per disk, so on the first line only.
+    for(int j = 0; j < d->nq; j++){
+      struct queue *q = &d->q[j];
+      printf("%d  %d  %s  %ld  %ld  %ld  %ld  %ld  %ld  %ld\n", i + 1, j,
+             d->eventidx ? "yes" : "no", q->nio, q->nnotify,
+             j == 0 ? d->nirq : 0, q->npolled, q->nintr, q->nspun,
+             q->nflush);
+    }
+  }
 }
@@ -28,11 +28,14 @@ kvmmake(void)
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, NDISK*PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
+  // ACLINT SSWI, for inter-processor interrupts
+  kvmmap(kpgtbl, ACLINT_SSWI, ACLINT_SSWI, PGSIZE, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -190,10 +193,18 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    // keep the address, for freeing below.
+    *pte &= ~PTE_V;
+  }
+
+  // other harts may still hold the old translations; the pages
+  // can't be handed out again until they have dropped them.
+  tlb_shootdown(pagetable, va, npages);
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(do_free)
+      kfree((void*)PTE2PA(*pte));
     *pte = 0;
   }
 }
@@ -350,6 +361,7 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  tlb_shootdown(pagetable, va, 1);
 }
 
 // Copy from kernel to user.
@@ -47,6 +47,8 @@
 #include "kernel/stat.h"
 #include "kernel/param.h"
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 #ifndef static_assert
 #define static_assert(a, b) \
     do                      \
@@ -58,15 +60,19 @@
 #endif
 
 #define NINODES 200
+#define GROUPSIZE 512 // blocks per block group; at most BPB
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | group 0 | group 1 | ... ]
+// with each group [ free bit map | inode blocks | data blocks ]
 
-int nbitmap      = FSSIZE / BPB + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog         = LOGSIZE;
+int nlog = LOGSIZE;
 
-int nmeta;   // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int ngroups; // Number of block groups
+int ipg;     // Inodes per group
+int gmeta;   // Meta blocks per group (bitmap, inode)
+int size;    // Size of the file system, without a runt last group
+int nmeta;   // Number of meta blocks (boot, sb, nlog, all groups' meta)
 int nblocks; // Number of data blocks
 
 int fsfd;
@@ -75,13 +81,15 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
-void balloc(int);
+uint dalloc(void);
+void balloc(void);
 void wsect(uint, void *);
 void winode(uint, struct dinode *);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dappend(uint dinum, uint inum, char *name);
 void die(const char *);
 
 /* Convert to riscv byte order */
@@ -113,10 +121,8 @@ uint xint(uint x)
 int main(int argc, char *argv[])
 {
     int i, cc, fd;
-    uint rootino, inum, off;
-    struct dirent de;
+    uint rootino, inum;
     char buf[BSIZE];
-    struct dinode din;
 
     static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
@@ -127,7 +133,6 @@ int main(int argc, char *argv[])
     }
 
     assert((BSIZE % sizeof(struct dinode)) == 0);
-    assert((BSIZE % sizeof(struct dirent)) == 0);
 
     fsfd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0666);
     if (fsfd < 0)
@@ -136,22 +141,36 @@ int main(int argc, char *argv[])
     }
 
     // 1 fs block = 1 disk sector
-    nmeta   = 2 + nlog + ninodeblocks + nbitmap;
-    nblocks = FSSIZE - nmeta;
+    static_assert(GROUPSIZE <= BPB, "A group's bitmap must fit in a block");
+    ngroups = (FSSIZE - 2 - nlog + GROUPSIZE - 1) / GROUPSIZE;
+    ipg     = (NINODES + ngroups - 1) / ngroups;
+    ipg     = (ipg + IPB - 1) / IPB * IPB;
+    gmeta   = 1 + ipg / IPB;
+    size    = FSSIZE;
+    if ((FSSIZE - 2 - nlog) % GROUPSIZE != 0 && (FSSIZE - 2 - nlog) % GROUPSIZE <= gmeta)
+    {
+        // too short a last group to hold any data: leave it out.
+        ngroups--;
+        size = 2 + nlog + ngroups * GROUPSIZE;
+    }
+    nmeta   = 2 + nlog + ngroups * gmeta;
+    nblocks = size - nmeta;
 
     sb.magic      = FSMAGIC;
-    sb.size       = xint(FSSIZE);
+    sb.size       = xint(size);
     sb.nblocks    = xint(nblocks);
-    sb.ninodes    = xint(NINODES);
+    sb.ninodes    = xint(ngroups * ipg);
     sb.nlog       = xint(nlog);
     sb.logstart   = xint(2);
-    sb.inodestart = xint(2 + nlog);
-    sb.bmapstart  = xint(2 + nlog + ninodeblocks);
+    sb.groupstart = xint(2 + nlog);
+    sb.groupsize  = xint(GROUPSIZE);
+    sb.ngroups    = xint(ngroups);
+    sb.ipg        = xint(ipg);
 
-    printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-           nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+    printf("nmeta %d (boot, super, log blocks %u, %d groups of %d blocks with %d inodes) blocks %d total %d\n",
+           nmeta, nlog, ngroups, GROUPSIZE, ipg, nblocks, size);
 
-    freeblock = nmeta; // the first free block that we can allocate
+    freeblock = 2 + nlog + gmeta; // the first free block that we can allocate
 
     for (i = 0; i < FSSIZE; i++)
     {
@@ -165,15 +184,8 @@ int main(int argc, char *argv[])
     rootino = ialloc(T_DIR);
     assert(rootino == ROOTINO);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(rootino);
-    strcpy(de.name, ".");
-    iappend(rootino, &de, sizeof(de));
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(rootino);
-    strcpy(de.name, "..");
-    iappend(rootino, &de, sizeof(de));
+    dappend(rootino, rootino, ".");
+    dappend(rootino, rootino, "..");
 
     for (i = 2; i < argc; i++)
     {
@@ -209,10 +221,7 @@ int main(int argc, char *argv[])
 
         inum = ialloc(T_FILE);
 
-        bzero(&de, sizeof(de));
-        de.inum = xshort(inum);
-        strncpy(de.name, shortname, DIRSIZ);
-        iappend(rootino, &de, sizeof(de));
+        dappend(rootino, inum, shortname);
 
         while ((cc = read(fd, buf, sizeof(buf))) > 0)
         {
@@ -222,16 +231,7 @@ int main(int argc, char *argv[])
         close(fd);
     }
 
-    // fix size of root inode dir
-    rinode(rootino, &din);
-
-    off = xint(din.size);
-    off = ((off / BSIZE) + 1) * BSIZE;
-
-    din.size = xint(off);
-    winode(rootino, &din);
-
-    balloc(freeblock);
+    balloc();
 
     exit(0);
 }
@@ -302,6 +302,12 @@ uint ialloc(ushort type)
 
     bzero(&din, sizeof(din));
 
+    // files and directories start with inline contents.
+    if (type != T_DEVICE)
+    {
+        type |= DI_INLINE;
+    }
+
     din.type  = xshort(type);
     din.nlink = xshort(1);
     din.size  = xint(0);
@@ -310,26 +316,49 @@ uint ialloc(ushort type)
     return inum;
 }
 
-/* Allocates blocks in the file system bitmap. */
-void balloc(int used)
+/* Allocates the next data block, skipping the meta blocks
+ * at the start of each group. */
+uint dalloc(void)
 {
-    uchar buf[BSIZE];
-    int i;
+    uint b = freeblock++;
 
-    printf("balloc: first %d blocks have been allocated\n", used);
-    assert(used < BPB);
-    bzero(buf, BSIZE);
-
-    for (i = 0; i < used; i++)
+    if (BBIT(freeblock, sb) == 0)
     {
-        buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        freeblock += gmeta;
     }
-
-    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-    wsect(sb.bmapstart, buf);
+    if (b >= size)
+    {
+        die("dalloc: out of blocks");
+    }
+    return b;
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
+/* Writes each group's bitmap, marking its meta blocks and
+ * the data blocks allocated below freeblock. */
+void balloc(void)
+{
+    uchar buf[BSIZE];
+    uint g, i, start, used;
+
+    printf("balloc: first %d blocks have been allocated\n", freeblock);
+    for (g = 0; g < ngroups; g++)
+    {
+        bzero(buf, BSIZE);
+        start = GSTART(g, sb);
+        used  = freeblock > start ? min(freeblock - start, GROUPSIZE) : 0;
+        if (used < gmeta)
+        {
+            used = gmeta;
+        }
+
+        for (i = 0; i < used; i++)
+        {
+            buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+
+        wsect(start, buf);
+    }
+}
 
 /* Appends data to a file's inode. */
 void iappend(uint inum, void *xp, int n)
@@ -343,6 +372,28 @@ void iappend(uint inum, void *xp, int n)
 
     rinode(inum, &din);
     off = xint(din.size);
+
+    if (xshort(din.type) & DI_INLINE)
+    {
+        if (off + n <= NINLINE)
+        {
+            bcopy(p, (char *)din.addrs + off, n);
+            din.size = xint(off + n);
+            winode(inum, &din);
+            return;
+        }
+
+        // too big to stay inline: move the contents to blocks.
+        char data[NINLINE];
+        bcopy(din.addrs, data, NINLINE);
+        bzero(din.addrs, sizeof(din.addrs));
+        din.type = xshort(xshort(din.type) & ~DI_INLINE);
+        din.size = xint(0);
+        winode(inum, &din);
+        iappend(inum, data, off);
+        rinode(inum, &din);
+    }
+
     // printf("append inum %d at off %d sz %d\n", inum, off, n);
     while (n > 0)
     {
@@ -352,7 +403,7 @@ void iappend(uint inum, void *xp, int n)
         {
             if (xint(din.addrs[fbn]) == 0)
             {
-                din.addrs[fbn] = xint(freeblock++);
+                din.addrs[fbn] = xint(dalloc());
             }
             x = xint(din.addrs[fbn]);
         }
@@ -361,13 +412,13 @@ void iappend(uint inum, void *xp, int n)
         {
             if (xint(din.addrs[NDIRECT]) == 0)
             {
-                din.addrs[NDIRECT] = xint(freeblock++);
+                din.addrs[NDIRECT] = xint(dalloc());
             }
 
             rsect(xint(din.addrs[NDIRECT]), (char *)indirect);
             if (indirect[fbn - NDIRECT] == 0)
             {
-                indirect[fbn - NDIRECT] = xint(freeblock++);
+                indirect[fbn - NDIRECT] = xint(dalloc());
                 wsect(xint(din.addrs[NDIRECT]), (char *)indirect);
             }
             x = xint(indirect[fbn - NDIRECT]);
@@ -388,6 +439,43 @@ void iappend(uint inum, void *xp, int n)
     winode(inum, &din);
 }
 
+/* Appends a directory entry for (name, inum) to directory dinum.
+ * An entry that doesn't fit in the rest of the last block goes
+ * to the next block, and the previous entry takes the rest. */
+void dappend(uint dinum, uint inum, char *name)
+{
+    static uint lastoff; // of the last entry; the root is the only directory
+    struct dinode din;
+    struct dirent de;
+    char buf[BSIZE];
+    uint off, rest, len = strlen(name), need = DIRENTSIZE(len);
+    struct dirent *last;
+
+    rinode(dinum, &din);
+    off = xint(din.size);
+    if (off % BSIZE != 0 && off % BSIZE + need > BSIZE)
+    {
+        // lengthen the last entry, in place.
+        rest = BSIZE - off % BSIZE;
+        assert(lastoff / BSIZE < NDIRECT && (xshort(din.type) & DI_INLINE) == 0);
+        rsect(xint(din.addrs[lastoff / BSIZE]), buf);
+        last = (struct dirent *)(buf + lastoff % BSIZE);
+        last->reclen = xshort(xshort(last->reclen) + rest);
+        wsect(xint(din.addrs[lastoff / BSIZE]), buf);
+        bzero(buf, rest);
+        iappend(dinum, buf, rest);
+        off += rest;
+    }
+
+    bzero(&de, sizeof(de));
+    de.inum    = xshort(inum);
+    de.reclen  = xshort(need);
+    de.namelen = xshort(len);
+    memmove(de.name, name, len);
+    iappend(dinum, &de, need);
+    lastoff = off;
+}
+
 /* Handles errors by printing an error message and exiting. */
 void die(const char *s)
 {
@@ -4,10 +4,12 @@
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 
+#define NAMEWIDTH 14  // names are padded to this width
+
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[NAMEWIDTH+1];
   char *p;
 
   // Find first character after last slash.
@@ -16,10 +18,10 @@ fmtname(char *path)
   p++;
 
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= NAMEWIDTH)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', NAMEWIDTH-strlen(p));
   return buf;
 }
 
@@ -56,11 +58,8 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
+    while(readdir(fd, &de)){
+      strcpy(p, de.name);
       if(stat(buf, &st) < 0){
         printf("ls: cannot stat %s\n", buf);
         continue;
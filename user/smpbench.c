@@ -0,0 +1,253 @@
+/***************************************************************************
+ *
+ * @file smpbench.c
+ * @brief SMP scalability benchmark with per-hart pinned workers.
+ *
+ * For every hart count n from 1 up to the number of online harts, this
+ * program forks n workers, pins worker i to hart i with
+ * sched_setaffinity(), and lets each worker run the same fixed amount of
+ * independent work. The aggregate throughput of the group is then
+ * reported next to the single-hart throughput, so each line shows how
+ * far the kernel subsystem under test scales.
+ *
+ * Workloads (each worker only touches its own objects):
+ * - file: create, write, read back and unlink a private file.
+ * - pipe: push a message through a private pipe and read it back.
+ * - sbrk: grow the heap, touch every page, and shrink it again.
+ *
+ * Usage:
+ *   smpbench [-s scale] [file|pipe|sbrk ...]
+ *
+ * -s multiplies the default iteration count of every workload.
+ *
+ * Online harts are found by probing sched_setaffinity(), which fails for
+ * harts that did not boot. Run `make smpbench` to repeat the benchmark
+ * for CPUS=1..8.
+ *
+ **************************************************************************/
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXHARTS 64
+#define MSGSIZE 64
+#define SBRKPAGES 4
+
+static char wbuf[1024];
+static char rbuf[1024];
+
+static void file_work(int id, int iters)
+{
+  char name[16];
+  int fd;
+
+  strcpy(name, "smpb.");
+  name[5] = 'a' + id / 26;
+  name[6] = 'a' + id % 26;
+  name[7] = 0;
+
+  for (int i = 0; i < iters; i++)
+  {
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+    {
+      fprintf(2, "smpbench: create %s failed\n", name);
+      exit(1);
+    }
+    if (write(fd, wbuf, sizeof(wbuf)) != sizeof(wbuf))
+    {
+      fprintf(2, "smpbench: write %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+
+    if ((fd = open(name, O_RDONLY)) < 0 || read(fd, rbuf, sizeof(rbuf)) != sizeof(rbuf))
+    {
+      fprintf(2, "smpbench: read %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+  }
+}
+
+static void pipe_work(int id, int iters)
+{
+  int fds[2];
+
+  if (pipe(fds) < 0)
+  {
+    fprintf(2, "smpbench: pipe failed\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < iters; i++)
+  {
+    if (write(fds[1], wbuf, MSGSIZE) != MSGSIZE || read(fds[0], rbuf, MSGSIZE) != MSGSIZE)
+    {
+      fprintf(2, "smpbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void sbrk_work(int id, int iters)
+{
+  for (int i = 0; i < iters; i++)
+  {
+    char *a = sbrk(SBRKPAGES * PGSIZE);
+    if (a == (char *)-1)
+    {
+      fprintf(2, "smpbench: sbrk failed\n");
+      exit(1);
+    }
+    for (int pg = 0; pg < SBRKPAGES; pg++)
+      a[pg * PGSIZE] = i;
+    sbrk(-SBRKPAGES * PGSIZE);
+  }
+}
+
+struct workload
+{
+  void (*f)(int, int);
+  char *name;
+  int iters; // per worker, before scaling by -s
+} workloads[] = {
+    {file_work, "file", 20},
+    {pipe_work, "pipe", 2000},
+    {sbrk_work, "sbrk", 200},
+    {0, 0, 0},
+};
+
+// Find the online harts by trying to pin ourselves to each in turn.
+static int probeharts(int *harts)
+{
+  int n = 0;
+
+  for (int i = 0; i < MAXHARTS; i++)
+  {
+    if (sched_setaffinity(0, (uint64)1 << i) == 0)
+      harts[n++] = i;
+  }
+  sched_setaffinity(0, ~(uint64)0);
+  return n;
+}
+
+// Run nworkers pinned workers and return the elapsed ticks.
+static int runset(struct workload *w, int *harts, int nworkers, int iters)
+{
+  int start, xstatus, failed = 0;
+
+  start = uptime();
+  for (int i = 0; i < nworkers; i++)
+  {
+    int pid = fork();
+    if (pid < 0)
+    {
+      fprintf(2, "smpbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0)
+    {
+      if (sched_setaffinity(0, (uint64)1 << harts[i]) < 0)
+      {
+        fprintf(2, "smpbench: cannot pin to hart %d\n", harts[i]);
+        exit(1);
+      }
+      w->f(i, iters);
+      exit(0);
+    }
+  }
+  for (int i = 0; i < nworkers; i++)
+  {
+    wait(&xstatus);
+    if (xstatus != 0)
+      failed = 1;
+  }
+  if (failed)
+  {
+    fprintf(2, "smpbench: %s worker failed\n", w->name);
+    exit(1);
+  }
+
+  int ticks = uptime() - start;
+  return ticks > 0 ? ticks : 1;
+}
+
+static void bench(struct workload *w, int *harts, int nharts, int scale)
+{
+  int iters = w->iters * scale;
+  uint64 base = 0;
+
+  for (int n = 1; n <= nharts; n++)
+  {
+    int ticks = runset(w, harts, n, iters);
+    // 10 ticks per second.
+    uint64 opsps = (uint64)n * iters * 10 / ticks;
+    if (n == 1)
+      base = opsps > 0 ? opsps : 1;
+    uint64 speedup = opsps * 100 / base;
+    printf("%s: harts %d ops %d ticks %d ops/s %d speedup %d.%d%d\n",
+           w->name, n, n * iters, ticks, (int)opsps,
+           (int)(speedup / 100), (int)(speedup / 10 % 10), (int)(speedup % 10));
+  }
+}
+
+static void usage(void)
+{
+  fprintf(2, "Usage: smpbench [-s scale] [file|pipe|sbrk ...]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int harts[MAXHARTS];
+  int scale = 1, nsel = 0;
+  int i;
+
+  memset(wbuf, 'x', sizeof(wbuf));
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+    {
+      scale = atoi(argv[++i]);
+      if (scale < 1)
+        usage();
+    }
+    else
+    {
+      struct workload *w;
+      for (w = workloads; w->name; w++)
+        if (strcmp(argv[i], w->name) == 0)
+          break;
+      if (w->name == 0)
+        usage();
+      nsel++;
+    }
+  }
+
+  int nharts = probeharts(harts);
+  printf("smpbench: %d harts online\n", nharts);
+
+  for (struct workload *w = workloads; w->name; w++)
+  {
+    int run = (nsel == 0);
+    for (i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "-s") == 0)
+        i++;
+      else if (strcmp(argv[i], w->name) == 0)
+        run = 1;
+    }
+    if (run)
+      bench(w, harts, nharts, scale);
+  }
+
+  printf("smpbench: done\n");
+  exit(0);
+}
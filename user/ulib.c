@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/fs.h"
 #include "user/user.h"
 
 //
@@ -95,6 +96,25 @@ stat(const char *n, struct stat *st)
   return r;
 }
 
+// Read the next entry in use from directory fd into de,
+// with its name NUL-terminated. Returns 0 at the end.
+int
+readdir(int fd, struct dirent *de)
+{
+  for(;;){
+    if(read(fd, de, DIRHDR) != DIRHDR || de->reclen < DIRHDR || de->namelen > DIRSIZ)
+      return 0;
+    if(read(fd, de->name, de->namelen) != de->namelen)
+      return 0;
+    de->name[de->namelen] = 0;
+    // skip the padding and any free space.
+    if(lseek(fd, de->reclen - DIRHDR - de->namelen, SEEK_CUR) < 0)
+      return 0;
+    if(de->inum != 0)
+      return 1;
+  }
+}
+
 int atoi(const char *s)
 {
   int n;
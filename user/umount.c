@@ -0,0 +1,25 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  if (2 > argc)
+  {
+    fprintf(2, "Usage: umount dirs...\n");
+    exit(1);
+  }
+
+  for (i = 1; i < argc; i++)
+  {
+    if (umount(argv[i]) < 0)
+    {
+      fprintf(2, "umount: %s is busy or not mounted\n", argv[i]);
+      break;
+    }
+  }
+
+  exit(0);
+}
@@ -1,4 +1,5 @@
 struct stat;
+struct dirent;
 
 // system calls
 int fork(void);
@@ -22,9 +23,19 @@ int getpid(void);
 char *sbrk(int);
 int sleep(int);
 int uptime(void);
+int sched_setaffinity(int, uint64);
+int sched_getaffinity(int, uint64 *);
+int mount(const char *, const char *);
+int umount(const char *);
+int sync(void);
+int fsync(int);
+int fallocate(int, int, int);
+int ftruncate(int, int);
+int lseek(int, int, int);
 
 // ulib.c
 int stat(const char *, struct stat *);
+int readdir(int, struct dirent *);
 char *strcpy(char *, const char *);
 void *memmove(void *, const void *, int);
 char *strchr(const char *, char c);
@@ -1618,11 +1618,7 @@ void concreate(char *s)
     char file[3];
     int i, pid, n, fd;
     char fa[N];
-    struct
-    {
-        ushort inum;
-        char name[DIRSIZ];
-    } de;
+    struct dirent de;
 
     file[0] = 'C';
     file[2] = '\0';
@@ -1665,10 +1661,8 @@ void concreate(char *s)
     memset(fa, 0, sizeof(fa));
     fd = open(".", 0);
     n = 0;
-    while (read(fd, &de, sizeof(de)) > 0)
+    while (readdir(fd, &de))
     {
-        if (de.inum == 0)
-            continue;
         if (de.name[0] == 'C' && de.name[2] == '\0')
         {
             i = de.name[1] - '0';
@@ -2076,55 +2070,128 @@ void bigfile(char *s)
     unlink("bigfile.dat");
 }
 
-void fourteen(char *s)
+// names of up to DIRSIZ bytes; longer path elements are
+// cut down to DIRSIZ.
+void longnames(char *s)
 {
-    int fd;
+    static char a[DIRSIZ + 2], b[DIRSIZ + 2], path[MAXPATH];
+    struct dirent de;
+    int fd, found;
 
-    // DIRSIZ is 14.
+    memset(a, 'a', DIRSIZ + 1);
+    a[DIRSIZ + 1] = 0;
+    memset(b, 'b', DIRSIZ);
+    b[DIRSIZ] = 0;
 
-    if (mkdir("12345678901234") != 0)
+    // a is one byte too long; the directory is called a[0..DIRSIZ).
+    if (mkdir(a) != 0)
     {
-        printf("%s: mkdir 12345678901234 failed\n", s);
+        printf("%s: mkdir of long name failed\n", s);
         exit(1);
     }
-    if (mkdir("12345678901234/123456789012345") != 0)
+    a[DIRSIZ] = 0;
+    strcpy(path, a);
+    strcpy(path + DIRSIZ, "/");
+    strcpy(path + DIRSIZ + 1, b);
+    fd = open(path, O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, "x", 1) != 1)
     {
-        printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+        printf("%s: create %d-byte name failed\n", s, DIRSIZ);
         exit(1);
     }
-    fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
-    if (fd < 0)
+    close(fd);
+    if (mkdir(path) == 0 || mkdir(a) == 0)
     {
-        printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+        printf("%s: mkdir of existing long name succeeded\n", s);
         exit(1);
     }
+
+    fd = open(a, O_RDONLY);
+    found = 0;
+    while (readdir(fd, &de))
+    {
+        if (strcmp(de.name, b) == 0)
+            found++;
+        else if (strcmp(de.name, ".") != 0 && strcmp(de.name, "..") != 0)
+        {
+            printf("%s: unexpected entry %s\n", s, de.name);
+            exit(1);
+        }
+    }
     close(fd);
-    fd = open("12345678901234/12345678901234/12345678901234", 0);
-    if (fd < 0)
+    if (found != 1)
     {
-        printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+        printf("%s: long name missing from directory\n", s);
         exit(1);
     }
-    close(fd);
 
-    if (mkdir("12345678901234/12345678901234") == 0)
+    if (unlink(path) != 0 || unlink(a) != 0)
     {
-        printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+        printf("%s: unlink of long names failed\n", s);
         exit(1);
     }
-    if (mkdir("123456789012345/12345678901234") == 0)
+}
+
+// many names of different lengths in one directory, so that
+// entries are packed and reused and cross into new blocks.
+void dirents(char *s)
+{
+    char name[64];
+    struct dirent de;
+    int fd, i, n;
+
+    if (mkdir("dd") != 0 || chdir("dd") != 0)
     {
-        printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+        printf("%s: mkdir dd failed\n", s);
         exit(1);
     }
+    for (i = 0; i < 150; i++)
+    {
+        memset(name, 'a' + i % 26, 1 + i % 40);
+        name[1 + i % 40] = 0;
+        name[0] = '0' + i % 10;
+        name[1 + i % 40 - 1] = 'A' + i / 10;
+        fd = open(name, O_CREATE | O_RDWR);
+        if (fd < 0)
+        {
+            printf("%s: create %s failed\n", s, name);
+            exit(1);
+        }
+        close(fd);
+        // free every third entry again, for reuse.
+        if (i % 3 == 0 && unlink(name) != 0)
+        {
+            printf("%s: unlink %s failed\n", s, name);
+            exit(1);
+        }
+    }
 
-    // clean up
-    unlink("123456789012345/12345678901234");
-    unlink("12345678901234/12345678901234");
-    unlink("12345678901234/12345678901234/12345678901234");
-    unlink("123456789012345/123456789012345/123456789012345");
-    unlink("12345678901234/123456789012345");
-    unlink("12345678901234");
+    fd = open(".", O_RDONLY);
+    n = 0;
+    while (readdir(fd, &de))
+        n++;
+    close(fd);
+    if (n != 2 + 100)
+    {
+        printf("%s: %d entries instead of %d\n", s, n, 2 + 100);
+        exit(1);
+    }
+
+    fd = open(".", O_RDONLY);
+    while (readdir(fd, &de))
+    {
+        if (strcmp(de.name, ".") != 0 && strcmp(de.name, "..") != 0 && unlink(de.name) != 0)
+        {
+            printf("%s: unlink %s failed\n", s, de.name);
+            exit(1);
+        }
+    }
+    close(fd);
+    if (chdir("..") != 0 || unlink("dd") != 0)
+    {
+        printf("%s: unlink dd failed\n", s);
+        exit(1);
+    }
 }
 
 void rmdot(char *s)
@@ -2962,6 +3029,963 @@ void badarg(char *s)
     exit(0);
 }
 
+// sched_setaffinity()/sched_getaffinity() round trip, inheritance
+// across fork, and rejection of empty masks and unknown pids.
+void affinity(char *s)
+{
+    uint64 all, one, got;
+    int pid, xstatus;
+
+    if (sched_getaffinity(0, &all) < 0 || all == 0)
+    {
+        printf("%s: sched_getaffinity failed\n", s);
+        exit(1);
+    }
+    one = all & -all; // lowest online hart
+
+    if (sched_setaffinity(0, one) < 0)
+    {
+        printf("%s: sched_setaffinity failed\n", s);
+        exit(1);
+    }
+    if (sched_getaffinity(0, &got) < 0 || got != one)
+    {
+        printf("%s: mask not applied\n", s);
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        if (sched_getaffinity(0, &got) < 0 || got != one)
+        {
+            printf("%s: child did not inherit mask\n", s);
+            exit(1);
+        }
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0)
+        exit(1);
+
+    if (sched_setaffinity(0, 0) != -1)
+    {
+        printf("%s: empty mask accepted\n", s);
+        exit(1);
+    }
+    if (sched_setaffinity(1000000, all) != -1 || sched_getaffinity(1000000, &got) != -1)
+    {
+        printf("%s: unknown pid accepted\n", s);
+        exit(1);
+    }
+    if (sched_setaffinity(0, all) < 0 || sched_getaffinity(0, &got) < 0 || got != all)
+    {
+        printf("%s: could not restore mask\n", s);
+        exit(1);
+    }
+}
+
+// pin one child to every online hart and have them all spin at
+// once, so each hart runs a user process concurrently with the rest.
+// meant to be run with many harts, e.g. make scaletest.
+void allharts(char *s)
+{
+    uint64 all;
+    int fds[2], n = 0, xstatus;
+    char c;
+
+    if (sched_getaffinity(0, &all) < 0)
+    {
+        printf("%s: sched_getaffinity failed\n", s);
+        exit(1);
+    }
+    if (pipe(fds) < 0)
+    {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+
+    for (int hart = 0; hart < 64; hart++)
+    {
+        if ((all & ((uint64)1 << hart)) == 0)
+            continue;
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            uint64 got;
+            close(fds[0]);
+            if (sched_setaffinity(0, (uint64)1 << hart) < 0 ||
+                sched_getaffinity(0, &got) < 0 || got != ((uint64)1 << hart))
+            {
+                printf("%s: cannot pin to hart %d\n", s, hart);
+                exit(1);
+            }
+            for (volatile int i = 0; i < 1000000; i++)
+                ;
+            write(fds[1], "x", 1);
+            exit(0);
+        }
+        n++;
+    }
+    close(fds[1]);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (read(fds[0], &c, 1) != 1)
+        {
+            printf("%s: only %d of %d harts reported\n", s, i, n);
+            exit(1);
+        }
+    }
+    close(fds[0]);
+    for (int i = 0; i < n; i++)
+    {
+        wait(&xstatus);
+        if (xstatus != 0)
+            exit(1);
+    }
+}
+
+// files in the tmpfs that init mounts on /tmp: contents,
+// device number, and ".." leading back out of the mount.
+void tmpfs(char *s)
+{
+    struct stat root, st;
+    int fd, i;
+
+    if (stat("/", &root) < 0 || stat("/tmp", &st) < 0)
+    {
+        printf("%s: stat failed\n", s);
+        exit(1);
+    }
+    if (st.dev == root.dev || st.type != T_DIR)
+    {
+        printf("%s: /tmp is not a mounted file system\n", s);
+        exit(1);
+    }
+
+    fd = open("/tmp/tmpfsfile", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 20; i++)
+    {
+        memset(buf, 'a' + i, BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+        {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    fd = open("/tmp/tmpfsfile", O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.size != 20 * BSIZE || st.dev == root.dev)
+    {
+        printf("%s: reopen failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 20; i++)
+    {
+        if (read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + i || buf[BSIZE - 1] != 'a' + i)
+        {
+            printf("%s: read back wrong data\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+    if (link("/tmp/tmpfsfile", "tmpfslink") == 0)
+    {
+        printf("%s: link across file systems succeeded\n", s);
+        exit(1);
+    }
+    if (unlink("/tmp/tmpfsfile") < 0 || open("/tmp/tmpfsfile", O_RDONLY) >= 0)
+    {
+        printf("%s: unlink failed\n", s);
+        exit(1);
+    }
+
+    if (mkdir("/tmp/tmpfsdir") < 0 || chdir("/tmp/tmpfsdir") < 0)
+    {
+        printf("%s: mkdir failed\n", s);
+        exit(1);
+    }
+    if (stat("../..", &st) < 0 || st.dev != root.dev || st.ino != root.ino)
+    {
+        printf("%s: .. does not leave the mount\n", s);
+        exit(1);
+    }
+    if (chdir("/") < 0 || unlink("/tmp/tmpfsdir") < 0)
+    {
+        printf("%s: rmdir failed\n", s);
+        exit(1);
+    }
+}
+
+// mount and umount a tmpfs, and disk2 when qemu has one
+// (make qemu XDISKS=2): busy file systems cannot be unmounted,
+// mount points cannot be unlinked, and files on a disk survive
+// an unmount.
+void mounts(char *s)
+{
+    int fd;
+    char c;
+
+    unlink("mnt0");
+    if (mkdir("mnt0") < 0 || mount("tmpfs", "mnt0") < 0)
+    {
+        printf("%s: mount tmpfs failed\n", s);
+        exit(1);
+    }
+    if (mount("nosuchfs", "mnt0") == 0 || mount("tmpfs", "nosuchdir") == 0)
+    {
+        printf("%s: bad mount succeeded\n", s);
+        exit(1);
+    }
+    if ((fd = open("mnt0/f", O_CREATE | O_RDWR)) < 0 || write(fd, "x", 1) != 1)
+    {
+        printf("%s: create on tmpfs failed\n", s);
+        exit(1);
+    }
+    if (umount("mnt0") == 0)
+    {
+        printf("%s: umount of busy tmpfs succeeded\n", s);
+        exit(1);
+    }
+    close(fd);
+    if (unlink("mnt0") == 0)
+    {
+        printf("%s: unlink of a mount point succeeded\n", s);
+        exit(1);
+    }
+    if (umount("mnt0") < 0)
+    {
+        printf("%s: umount tmpfs failed\n", s);
+        exit(1);
+    }
+    if (open("mnt0/f", O_RDONLY) >= 0 || umount("mnt0") == 0)
+    {
+        printf("%s: tmpfs still mounted\n", s);
+        exit(1);
+    }
+
+    if (mount("disk2", "mnt0") == 0)
+    {
+        unlink("mnt0/f");
+        if ((fd = open("mnt0/f", O_CREATE | O_RDWR)) < 0 || write(fd, "y", 1) != 1)
+        {
+            printf("%s: create on disk2 failed\n", s);
+            exit(1);
+        }
+        close(fd);
+        if (mount("disk2", "mnt0") == 0 || umount("mnt0") < 0 || mount("disk2", "mnt0") < 0)
+        {
+            printf("%s: remount disk2 failed\n", s);
+            exit(1);
+        }
+        if ((fd = open("mnt0/f", O_RDONLY)) < 0 || read(fd, &c, 1) != 1 || c != 'y')
+        {
+            printf("%s: disk2 lost a file\n", s);
+            exit(1);
+        }
+        close(fd);
+        if (unlink("mnt0/f") < 0 || umount("mnt0") < 0)
+        {
+            printf("%s: umount disk2 failed\n", s);
+            exit(1);
+        }
+    }
+
+    if (unlink("mnt0") < 0)
+    {
+        printf("%s: unlink mnt0 failed\n", s);
+        exit(1);
+    }
+}
+
+// files written through the write-back cache survive sync()
+// and fsync(), and fsync() of a bad fd fails.
+void syncfsync(char *s)
+{
+    int fd, i;
+
+    fd = open("syncf", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 10; i++)
+    {
+        memset(buf, 'a' + i, BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE || fsync(fd) < 0)
+        {
+            printf("%s: write/fsync failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+    if (fsync(fd) == 0 || fsync(-1) == 0)
+    {
+        printf("%s: fsync of closed fd succeeded\n", s);
+        exit(1);
+    }
+    if (sync() < 0)
+    {
+        printf("%s: sync failed\n", s);
+        exit(1);
+    }
+
+    fd = open("syncf", O_RDONLY);
+    if (fd < 0)
+    {
+        printf("%s: reopen failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 10; i++)
+    {
+        if (read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + i || buf[BSIZE - 1] != 'a' + i)
+        {
+            printf("%s: wrong data after sync\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+    unlink("syncf");
+}
+
+// appends of odd sizes, so that writes start and end in the
+// middle of blocks that the same write allocates.
+void appendodd(char *s)
+{
+    int fd, i, j, n, tot;
+    static char rb[BSIZE];
+
+    unlink("appendodd");
+    fd = open("appendodd", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    tot = 0;
+    for (i = 0; i < 16; i++)
+    {
+        n = 700 + 97 * i;
+        for (j = 0; j < n; j++)
+            buf[j] = (tot + j) % 251;
+        if (write(fd, buf, n) != n)
+        {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+        tot += n;
+    }
+    close(fd);
+
+    fd = open("appendodd", O_RDONLY);
+    for (i = 0; i < tot; i += n)
+    {
+        n = read(fd, rb, sizeof(rb));
+        if (n <= 0)
+        {
+            printf("%s: short file\n", s);
+            exit(1);
+        }
+        for (j = 0; j < n; j++)
+        {
+            if ((uchar)rb[j] != (i + j) % 251)
+            {
+                printf("%s: wrong byte at %d\n", s, i + j);
+                exit(1);
+            }
+        }
+    }
+    if (read(fd, rb, sizeof(rb)) != 0)
+    {
+        printf("%s: file too long\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("appendodd");
+}
+
+// preallocate a file, fill it, and cut it back down.
+void falloctrunc(char *s)
+{
+    struct stat st;
+    int fd, i;
+
+    unlink("falloc");
+    fd = open("falloc", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    if (fallocate(fd, 0, 40 * BSIZE) < 0 || fstat(fd, &st) < 0 || st.size != 0)
+    {
+        printf("%s: fallocate failed or changed the size\n", s);
+        exit(1);
+    }
+    if (fallocate(fd, 0, MAXFILE * BSIZE + 1) == 0 || fallocate(fd, -1, 1) == 0)
+    {
+        printf("%s: bad fallocate succeeded\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 20; i++)
+    {
+        memset(buf, 'a' + i, BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+        {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+
+    if (ftruncate(fd, 5 * BSIZE + 10) < 0 || fstat(fd, &st) < 0 || st.size != 5 * BSIZE + 10)
+    {
+        printf("%s: ftruncate failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    fd = open("falloc", O_RDWR);
+    if (read(fd, buf, BUFSZ) != 5 * BSIZE + 10 || buf[0] != 'a' || buf[5 * BSIZE + 9] != 'f')
+    {
+        printf("%s: wrong contents after ftruncate\n", s);
+        exit(1);
+    }
+    if (write(fd, "x", 1) != 1)
+    {
+        printf("%s: append after ftruncate failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    fd = open("falloc", O_RDONLY);
+    if (read(fd, buf, BUFSZ) != 5 * BSIZE + 11 || buf[5 * BSIZE + 10] != 'x')
+    {
+        printf("%s: wrong contents after append\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    fd = open("falloc", O_RDONLY);
+    if (ftruncate(fd, 0) == 0)
+    {
+        printf("%s: ftruncate of read-only fd succeeded\n", s);
+        exit(1);
+    }
+    close(fd);
+    fd = open(".", O_RDONLY);
+    if (fallocate(fd, 0, 1) == 0)
+    {
+        printf("%s: fallocate of directory succeeded\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("falloc");
+}
+
+// holes left by a write after lseek() past the end, and
+// by a growing ftruncate(), read as zeros.
+void sparse(char *s)
+{
+    char *names[] = {"sparse", "/tmp/sparse"};
+    int fd, i, k, n, off, mid, end;
+
+    for (k = 0; k < 2; k++)
+    {
+        // leave freed blocks with something other than zeros
+        // in them, for the holes below to be given.
+        unlink(names[k]);
+        fd = open(names[k], O_CREATE | O_RDWR);
+        if (fd < 0)
+        {
+            printf("%s: create %s failed\n", s, names[k]);
+            exit(1);
+        }
+        memset(buf, 'x', BSIZE);
+        for (i = 0; i < 8; i++)
+            write(fd, buf, BSIZE);
+        close(fd);
+        unlink(names[k]);
+
+        fd = open(names[k], O_CREATE | O_RDWR);
+        if (fd < 0)
+        {
+            printf("%s: create %s failed\n", s, names[k]);
+            exit(1);
+        }
+        // one byte at the start, then 100 blocks of hole,
+        // into the indirect blocks.
+        off = 100 * BSIZE + 7;
+        if (write(fd, "a", 1) != 1 || lseek(fd, off, SEEK_SET) != off || write(fd, "b", 1) != 1)
+        {
+            printf("%s: write past end failed\n", s);
+            exit(1);
+        }
+        if (lseek(fd, 0, SEEK_END) != off + 1 || lseek(fd, -2, SEEK_CUR) != off - 1 ||
+            lseek(fd, -1, SEEK_SET) >= 0 || lseek(fd, 0, 7) >= 0)
+        {
+            printf("%s: lseek failed\n", s);
+            exit(1);
+        }
+        end = off + 3 * BSIZE;
+        if (ftruncate(fd, end) < 0)
+        {
+            printf("%s: growing ftruncate failed\n", s);
+            exit(1);
+        }
+        // a few bytes in the middle of a hole, and a few
+        // appended into the hole ftruncate left: the rest of
+        // their blocks must still read as zeros.
+        mid = 50 * BSIZE + 10;
+        if (lseek(fd, mid, SEEK_SET) != mid || write(fd, "c", 1) != 1 ||
+            lseek(fd, 0, SEEK_END) != end || write(fd, "d", 1) != 1)
+        {
+            printf("%s: write into hole failed\n", s);
+            exit(1);
+        }
+        close(fd);
+
+        fd = open(names[k], O_RDONLY);
+        for (i = 0; (n = read(fd, buf, BSIZE)) > 0; i += n)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                int at = i + j;
+                char want = at == 0 ? 'a' : at == off ? 'b' : at == mid ? 'c' : at == end ? 'd' : 0;
+                if (buf[j] != want)
+                {
+                    printf("%s: byte %d of %s is %d\n", s, at, names[k], buf[j]);
+                    exit(1);
+                }
+            }
+        }
+        if (i != end + 1)
+        {
+            printf("%s: read %d bytes of %s, not %d\n", s, i, names[k], end + 1);
+            exit(1);
+        }
+        close(fd);
+        unlink(names[k]);
+    }
+}
+
+// small files live in the inode; check that their contents
+// survive growing out of it and shrinking back.
+void inlinedata(char *s)
+{
+    struct stat st;
+    int fd, i;
+    char rb[200];
+
+    unlink("inl");
+    fd = open("inl", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    // a byte at a time, from inline into the first block.
+    for (i = 0; i < 150; i++)
+    {
+        char c = 'A' + i % 50;
+        if (write(fd, &c, 1) != 1)
+        {
+            printf("%s: write %d failed\n", s, i);
+            exit(1);
+        }
+        if (i == 40)
+        {
+            if (lseek(fd, 0, SEEK_SET) != 0 || read(fd, rb, 100) != 41 || rb[40] != 'A' + 40)
+            {
+                printf("%s: read of inline file failed\n", s);
+                exit(1);
+            }
+            lseek(fd, 0, SEEK_END);
+        }
+    }
+    if (lseek(fd, 0, SEEK_SET) != 0 || read(fd, rb, sizeof(rb)) != 150)
+    {
+        printf("%s: read of spilled file failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 150; i++)
+    {
+        if (rb[i] != 'A' + i % 50)
+        {
+            printf("%s: byte %d wrong after spill\n", s, i);
+            exit(1);
+        }
+    }
+
+    // empty it, and write a hole followed by a byte.
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 20, SEEK_SET) != 20 || write(fd, "z", 1) != 1)
+    {
+        printf("%s: rewrite failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    fd = open("inl", O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.size != 21 || read(fd, rb, sizeof(rb)) != 21)
+    {
+        printf("%s: reopen failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 21; i++)
+    {
+        if (rb[i] != (i == 20 ? 'z' : 0))
+        {
+            printf("%s: byte %d wrong after rewrite\n", s, i);
+            exit(1);
+        }
+    }
+    close(fd);
+    unlink("inl");
+}
+
+// files whose blocks don't fit in their directory's block group
+// go on into the next groups, and read back intact.
+void groupspill(char *s)
+{
+    char name[8];
+    int fd, i, b;
+
+    if (mkdir("gd") != 0)
+    {
+        printf("%s: mkdir gd failed\n", s);
+        exit(1);
+    }
+    strcpy(name, "gd/f0");
+    for (i = 0; i < 3; i++)
+    {
+        name[4] = '0' + i;
+        fd = open(name, O_CREATE | O_WRONLY);
+        if (fd < 0)
+        {
+            printf("%s: create %s failed\n", s, name);
+            exit(1);
+        }
+        for (b = 0; b < 150; b++)
+        {
+            memset(buf, 'a' + (i * 150 + b) % 26, BSIZE);
+            if (write(fd, buf, BSIZE) != BSIZE)
+            {
+                printf("%s: write %s failed\n", s, name);
+                exit(1);
+            }
+        }
+        close(fd);
+    }
+    for (i = 0; i < 3; i++)
+    {
+        name[4] = '0' + i;
+        fd = open(name, O_RDONLY);
+        for (b = 0; b < 150; b++)
+        {
+            if (read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + (i * 150 + b) % 26 ||
+                buf[BSIZE - 1] != buf[0])
+            {
+                printf("%s: %s block %d wrong\n", s, name, b);
+                exit(1);
+            }
+        }
+        close(fd);
+        unlink(name);
+    }
+    if (unlink("gd") != 0)
+    {
+        printf("%s: unlink gd failed\n", s);
+        exit(1);
+    }
+}
+
+// a freed inode goes back into the free-inode map, and is
+// the next one its group hands out.
+void inodereuse(char *s)
+{
+    struct stat st;
+    uint ino;
+    int fd;
+
+    fd = open("ir1", O_CREATE | O_RDWR);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("%s: create ir1 failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    ino = st.ino;
+    unlink("ir1");
+
+    fd = open("ir2", O_CREATE | O_RDWR);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("%s: create ir2 failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("ir2");
+    if (st.ino != ino)
+    {
+        printf("%s: got inode %d, not freed inode %d\n", s, st.ino, ino);
+        exit(1);
+    }
+}
+
+// several processes read one file at once, some through
+// their own descriptors and some through a shared one, whose
+// offset must advance by whole reads.
+void sharedread(char *s)
+{
+    enum { NCHILD = 4, NCHUNK = 40, CHUNK = 512 };
+    char buf[CHUNK];
+    int fd, sfd, i, j, n, xst, total;
+
+    fd = open("sr", O_CREATE | O_RDWR);
+    if (fd < 0)
+    {
+        printf("%s: create sr failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < NCHUNK; i++)
+    {
+        memset(buf, 'a' + i % 26, CHUNK);
+        if (write(fd, buf, CHUNK) != CHUNK)
+        {
+            printf("%s: write sr failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    if ((sfd = open("sr", O_RDONLY)) < 0)
+    {
+        printf("%s: open sr failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < NCHILD; i++)
+    {
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            // the whole file, through a private descriptor.
+            if ((fd = open("sr", O_RDONLY)) < 0)
+                exit(255);
+            for (j = 0; j < NCHUNK; j++)
+            {
+                if (read(fd, buf, CHUNK) != CHUNK || buf[0] != 'a' + j % 26 || buf[CHUNK - 1] != buf[0])
+                    exit(255);
+            }
+            close(fd);
+
+            // a share of it, through the shared one.
+            n = 0;
+            while ((j = read(sfd, buf, CHUNK)) > 0)
+            {
+                if (j != CHUNK || buf[CHUNK - 1] != buf[0])
+                    exit(255);
+                n++;
+            }
+            exit(n);
+        }
+    }
+
+    total = 0;
+    for (i = 0; i < NCHILD; i++)
+    {
+        wait(&xst);
+        if (xst == 255)
+        {
+            printf("%s: child read wrong data\n", s);
+            exit(1);
+        }
+        total += xst;
+    }
+    close(sfd);
+    unlink("sr");
+    if (total != NCHUNK)
+    {
+        printf("%s: shared descriptor gave %d chunks, not %d\n", s, total, NCHUNK);
+        exit(1);
+    }
+}
+
+// after lookups have cached a path's directory entries, do
+// unlink, re-creation and removal of a directory still show?
+static int ncread(char *path)
+{
+    char c;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (read(fd, &c, 1) != 1)
+        c = -1;
+    close(fd);
+    return c;
+}
+
+static void ncwrite(char *s, char *path, char c)
+{
+    int fd;
+
+    if ((fd = open(path, O_CREATE | O_WRONLY)) < 0 || write(fd, &c, 1) != 1)
+    {
+        printf("%s: create %s failed\n", s, path);
+        exit(1);
+    }
+    close(fd);
+}
+
+void namecache(char *s)
+{
+    if (mkdir("nc") < 0 || mkdir("nc/d") < 0)
+    {
+        printf("%s: mkdir failed\n", s);
+        exit(1);
+    }
+    ncwrite(s, "nc/d/f", '1');
+    for (int i = 0; i < 3; i++)
+    {
+        if (ncread("nc/d/f") != '1' || ncread("nc/./d/../d/f") != '1')
+        {
+            printf("%s: cannot read nc/d/f\n", s);
+            exit(1);
+        }
+    }
+
+    if (unlink("nc/d/f") < 0 || ncread("nc/d/f") != -1)
+    {
+        printf("%s: nc/d/f still there after unlink\n", s);
+        exit(1);
+    }
+    ncwrite(s, "nc/d/f", '2');
+    if (ncread("nc/d/f") != '2')
+    {
+        printf("%s: read old nc/d/f\n", s);
+        exit(1);
+    }
+
+    if (chdir("nc/d") < 0 || ncread("../d/f") != '2' || ncread("f") != '2' || chdir("../..") < 0)
+    {
+        printf("%s: relative lookups failed\n", s);
+        exit(1);
+    }
+
+    if (unlink("nc/d/f") < 0 || unlink("nc/d") < 0)
+    {
+        printf("%s: unlink failed\n", s);
+        exit(1);
+    }
+    if (ncread("nc/d/.") != -1 || ncread("nc/d/f") != -1)
+    {
+        printf("%s: nc/d still there after unlink\n", s);
+        exit(1);
+    }
+    if (mkdir("nc/d") < 0 || ncread("nc/d/f") != -1 || ncread("nc/d/..") == -1)
+    {
+        printf("%s: new nc/d is wrong\n", s);
+        exit(1);
+    }
+    unlink("nc/d");
+    unlink("nc");
+}
+
+// one process keeps freeing blocks full of 'x' while another
+// has holes filled in, so that both often run in one
+// transaction and the holes are given blocks it freed. Those
+// must be zeroed through the log, not in place: a crash before
+// the commit would otherwise leave zeros in the first file.
+// Here at least they must read as zeros.
+void freerealloc(char *s)
+{
+    enum { NBLK = 8, NROUND = 20 };
+    int fd, i, j, n, pid, xst;
+
+    pid = fork();
+    if (pid < 0)
+    {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        if ((fd = open("fra", O_CREATE | O_RDWR)) < 0)
+            exit(1);
+        memset(buf, 'x', BSIZE);
+        for (i = 0; i < NROUND; i++)
+        {
+            for (j = 0; j < NBLK; j++)
+                if (write(fd, buf, BSIZE) != BSIZE)
+                    exit(1);
+            if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) != 0)
+                exit(1);
+        }
+        close(fd);
+        exit(0);
+    }
+
+    for (i = 0; i < NROUND; i++)
+    {
+        unlink("frb");
+        if ((fd = open("frb", O_CREATE | O_RDWR)) < 0)
+        {
+            printf("%s: create frb failed\n", s);
+            exit(1);
+        }
+        if (ftruncate(fd, NBLK * BSIZE) < 0 || fallocate(fd, 0, NBLK * BSIZE) < 0)
+        {
+            printf("%s: ftruncate or fallocate failed\n", s);
+            exit(1);
+        }
+        for (j = 0; j < NBLK; j++)
+        {
+            if ((n = read(fd, buf + BSIZE, BSIZE)) != BSIZE)
+            {
+                printf("%s: read frb failed\n", s);
+                exit(1);
+            }
+            for (n = 0; n < BSIZE; n++)
+            {
+                if (buf[BSIZE + n] != 0)
+                {
+                    printf("%s: byte %d of frb is %d\n", s, j * BSIZE + n, buf[BSIZE + n]);
+                    exit(1);
+                }
+            }
+        }
+        close(fd);
+    }
+
+    wait(&xst);
+    unlink("fra");
+    unlink("frb");
+    if (xst != 0)
+    {
+        printf("%s: child failed\n", s);
+        exit(1);
+    }
+}
+
 struct test
 {
     void (*f)(char *);
@@ -3005,7 +4029,8 @@ struct test
     {subdir, "subdir"},
     {bigwrite, "bigwrite"},
     {bigfile, "bigfile"},
-    {fourteen, "fourteen"},
+    {longnames, "longnames"},
+    {dirents, "dirents"},
     {rmdot, "rmdot"},
     {dirfile, "dirfile"},
     {iref, "iref"},
@@ -3027,6 +4052,20 @@ struct test
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
     {badarg, "badarg"},
+    {affinity, "affinity"},
+    {allharts, "allharts"},
+    {tmpfs, "tmpfs"},
+    {mounts, "mounts"},
+    {syncfsync, "syncfsync"},
+    {appendodd, "appendodd"},
+    {falloctrunc, "falloctrunc"},
+    {sparse, "sparse"},
+    {inlinedata, "inlinedata"},
+    {groupspill, "groupspill"},
+    {inodereuse, "inodereuse"},
+    {sharedread, "sharedread"},
+    {namecache, "namecache"},
+    {freerealloc, "freerealloc"},
 
     {0, 0},
 };
@@ -36,3 +36,12 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("mount");
+entry("umount");
+entry("sync");
+entry("fsync");
+entry("fallocate");
+entry("ftruncate");
+entry("lseek");